@@ -0,0 +1,86 @@
+/*
+ * Per-call cost of the clocks a Pinba timer can read on start and stop:
+ * getrusage() for pinba.timer_cpu=rusage, CLOCK_THREAD_CPUTIME_ID for
+ * pinba.timer_cpu=thread and the wall clocks behind pinba.clock.
+ *
+ * Usage: clock_bench [iterations]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# include <x86intrin.h>
+# define HAVE_RDTSC 1
+#endif
+
+static volatile int64_t sink;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void read_rusage(void)
+{
+	struct rusage u;
+
+	getrusage(RUSAGE_SELF, &u);
+	sink += u.ru_utime.tv_usec;
+}
+
+static void read_clock(clockid_t id)
+{
+	struct timespec ts;
+
+	clock_gettime(id, &ts);
+	sink += ts.tv_nsec;
+}
+
+static void read_thread_cputime(void) { read_clock(CLOCK_THREAD_CPUTIME_ID); }
+static void read_monotonic(void) { read_clock(CLOCK_MONOTONIC); }
+#ifdef CLOCK_MONOTONIC_COARSE
+static void read_monotonic_coarse(void) { read_clock(CLOCK_MONOTONIC_COARSE); }
+#endif
+#ifdef HAVE_RDTSC
+static void read_tsc(void) { sink += (int64_t)__rdtsc(); }
+#endif
+
+static void run(const char *name, void (*fn)(void), long iterations)
+{
+	int64_t start;
+	long i;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		fn();
+	}
+	printf("%-24s %8.1f ns/call\n", name, (double)(now_ns() - start) / iterations);
+}
+
+int main(int argc, char **argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+
+	if (iterations <= 0) {
+		fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	run("getrusage(RUSAGE_SELF)", read_rusage, iterations);
+	run("CLOCK_THREAD_CPUTIME_ID", read_thread_cputime, iterations);
+	run("CLOCK_MONOTONIC", read_monotonic, iterations);
+#ifdef CLOCK_MONOTONIC_COARSE
+	run("CLOCK_MONOTONIC_COARSE", read_monotonic_coarse, iterations);
+#endif
+#ifdef HAVE_RDTSC
+	run("rdtsc", read_tsc, iterations);
+#endif
+	return 0;
+}
@@ -0,0 +1,36 @@
+<?php
+/*
+ * Per-call cost of functions matching pinba.observe_functions and of
+ * functions that do not; compare a run with the allowlist to one without:
+ *
+ *   php -d extension=pinba.so -d pinba.observe_functions=Listed::call,listed observe_bench.php
+ *   php -d extension=pinba.so observe_bench.php
+ */
+
+class Listed { static function call($i) { return $i + 1; } }
+class Unlisted { static function call($i) { return $i + 1; } }
+function listed($i) { return $i + 1; }
+function unlisted($i) { return $i + 1; }
+
+$n = isset($argv[1]) ? (int)$argv[1] : 2000000;
+
+function run($what, $callable, $n)
+{
+	$start = hrtime(true);
+	for ($i = 0; $i < $n; $i++) {
+		$callable($i);
+	}
+	printf("%-16s %6.1f ns/call\n", $what, (hrtime(true) - $start) / $n);
+}
+
+/* warm up, the observer is set up on the first call */
+for ($i = 0; $i < 1000; $i++) {
+	Listed::call($i); Unlisted::call($i); listed($i); unlisted($i);
+}
+
+run("Listed::call", "Listed::call", $n);
+run("Unlisted::call", "Unlisted::call", $n);
+run("listed", "listed", $n);
+run("unlisted", "unlisted", $n);
+
+printf("observe_functions: %s, %d folded timer(s)\n", ini_get("pinba.observe_functions") ?: "none", count(pinba_get_info()["timers"]));
@@ -0,0 +1,206 @@
+/*
+ * Benchmark for the Pinba protobuf encoder and decoder.
+ *
+ * Builds Pinba__Request messages shaped like the ones pinba.c sends
+ * (a dictionary, request tags and N timers with a few tags each) and
+ * reports the cost of get_packed_size, pack and unpack per packet.
+ *
+ * Usage: pinba_bench [seconds per measurement]
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pinba.pb-c.h"
+
+typedef struct {
+	const char *name;
+	size_t timers;
+	size_t tags_per_timer;
+	size_t dictionary_size;
+} bench_shape;
+
+static const bench_shape shapes[] = {
+	{ "tiny",      10,    1,   16 },
+	{ "small",     100,   2,   64 },
+	{ "medium",    1000,  3,   256 },
+	{ "large",     5000,  3,   1024 },
+	{ "huge",      50000, 4,   4096 },
+};
+
+static uint32_t rng_state = 2463534242U;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void request_init(Pinba__Request *request, const bench_shape *shape)
+{
+	size_t i, n_tags = shape->timers * shape->tags_per_timer;
+
+	pinba__request__init(request);
+	request->hostname = "web-frontend-042.example.com";
+	request->server_name = "www.example.com";
+	request->script_name = "/index.php";
+	request->schema = "https";
+	request->request_count = 1;
+	request->document_size = 48213;
+	request->memory_peak = 8388608;
+	request->request_time = 0.1375f;
+	request->ru_utime = 0.09f;
+	request->ru_stime = 0.01f;
+	request->has_status = 1;
+	request->status = 200;
+
+	request->n_dictionary = shape->dictionary_size;
+	request->dictionary = malloc(shape->dictionary_size * sizeof(char *));
+	for (i = 0; i < shape->dictionary_size; i++) {
+		char buf[64];
+
+		/* mix of short tag names and longer values, like "group", "server" and host names */
+		snprintf(buf, sizeof(buf), (i % 4) ? "value-%zu.db.example.com" : "tag%zu", i);
+		request->dictionary[i] = strdup(buf);
+	}
+
+	request->n_tag_name = request->n_tag_value = 2;
+	request->tag_name = malloc(2 * sizeof(uint32_t));
+	request->tag_value = malloc(2 * sizeof(uint32_t));
+	for (i = 0; i < 2; i++) {
+		request->tag_name[i] = i;
+		request->tag_value[i] = i + 2;
+	}
+
+	request->n_timer_value = request->n_timer_hit_count = request->n_timer_tag_count = shape->timers;
+	request->n_timer_ru_utime = request->n_timer_ru_stime = shape->timers;
+	request->timer_value = malloc(shape->timers * sizeof(float));
+	request->timer_hit_count = malloc(shape->timers * sizeof(uint32_t));
+	request->timer_tag_count = malloc(shape->timers * sizeof(uint32_t));
+	request->timer_ru_utime = malloc(shape->timers * sizeof(float));
+	request->timer_ru_stime = malloc(shape->timers * sizeof(float));
+	for (i = 0; i < shape->timers; i++) {
+		request->timer_value[i] = (rng() % 100000) / 1e6f;
+		request->timer_hit_count[i] = (rng() % 8) ? 1 : rng() % 300;
+		request->timer_tag_count[i] = shape->tags_per_timer;
+		request->timer_ru_utime[i] = (rng() % 1000) / 1e6f;
+		request->timer_ru_stime[i] = (rng() % 100) / 1e6f;
+	}
+
+	request->n_timer_tag_name = request->n_timer_tag_value = n_tags;
+	request->timer_tag_name = malloc(n_tags * sizeof(uint32_t));
+	request->timer_tag_value = malloc(n_tags * sizeof(uint32_t));
+	for (i = 0; i < n_tags; i++) {
+		/* tag names come from a handful of entries, values are spread over the dictionary */
+		request->timer_tag_name[i] = (i % shape->tags_per_timer) * 4 % shape->dictionary_size;
+		request->timer_tag_value[i] = rng() % shape->dictionary_size;
+	}
+}
+
+static void request_destroy(Pinba__Request *request)
+{
+	size_t i;
+
+	for (i = 0; i < request->n_dictionary; i++) {
+		free(request->dictionary[i]);
+	}
+	free(request->dictionary);
+	free(request->tag_name);
+	free(request->tag_value);
+	free(request->timer_value);
+	free(request->timer_hit_count);
+	free(request->timer_tag_count);
+	free(request->timer_ru_utime);
+	free(request->timer_ru_stime);
+	free(request->timer_tag_name);
+	free(request->timer_tag_value);
+}
+
+/* volatile sink, keeps the compiler from dropping the measured calls */
+static volatile size_t sink;
+
+static void bench_shape_run(const bench_shape *shape, double seconds)
+{
+	Pinba__Request request;
+	uint8_t *buf;
+	size_t len, iterations, i;
+	double start, size_ns, pack_ns, unpack_ns;
+
+	request_init(&request, shape);
+	len = pinba__request__get_packed_size(&request);
+	buf = malloc(len);
+
+	/* calibrate on pack, then run every operation the same number of times */
+	iterations = 0;
+	start = now_ns();
+	do {
+		sink = pinba__request__pack(&request, buf);
+		iterations++;
+	} while (now_ns() - start < seconds * 1e9 / 3);
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		sink = pinba__request__get_packed_size(&request);
+	}
+	size_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		sink = pinba__request__pack(&request, buf);
+	}
+	pack_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (i = 0; i < iterations; i++) {
+		Pinba__Request *decoded = pinba__request__unpack(NULL, len, buf);
+
+		if (!decoded) {
+			fprintf(stderr, "%s: failed to unpack the packet\n", shape->name);
+			exit(1);
+		}
+		sink = decoded->n_timer_value;
+		pinba__request__free_unpacked(decoded, NULL);
+	}
+	unpack_ns = (now_ns() - start) / iterations;
+
+	printf("%-8s %7zu %5zu %6zu %10zu %14.0f %14.0f %14.0f %10zu\n",
+			shape->name, shape->timers, shape->tags_per_timer, shape->dictionary_size,
+			len, size_ns, pack_ns, unpack_ns, iterations);
+
+	free(buf);
+	request_destroy(&request);
+}
+
+int main(int argc, char **argv)
+{
+	double seconds = 1.0;
+	size_t i;
+
+	if (argc > 1) {
+		seconds = atof(argv[1]);
+		if (seconds <= 0) {
+			fprintf(stderr, "usage: %s [seconds per shape]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	printf("%-8s %7s %5s %6s %10s %14s %14s %14s %10s\n",
+			"shape", "timers", "tags", "dict", "bytes/pkt", "size ns/pkt", "pack ns/pkt", "unpack ns/pkt", "iters");
+	for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++) {
+		bench_shape_run(&shapes[i], seconds);
+	}
+	return 0;
+}
@@ -0,0 +1,40 @@
+/*
+ * libFuzzer entry point for pinba__request__unpack().
+ *
+ * Every successfully decoded packet is packed again and decoded a second
+ * time, so encoder bugs surface as well as decoder ones.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pinba.pb-c.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	Pinba__Request *request, *again;
+	uint8_t *packed;
+	size_t len;
+
+	request = pinba__request__unpack(NULL, size, data);
+	if (!request) {
+		return 0;
+	}
+
+	len = pinba__request__get_packed_size(request);
+	packed = malloc(len ? len : 1);
+	if (pinba__request__pack(request, packed) != len) {
+		abort();
+	}
+
+	again = pinba__request__unpack(NULL, len, packed);
+	if (!again || again->n_timer_value != request->n_timer_value || again->n_dictionary != request->n_dictionary) {
+		abort();
+	}
+
+	pinba__request__free_unpacked(again, NULL);
+	pinba__request__free_unpacked(request, NULL);
+	free(packed);
+	return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Throughput of pinba_sketch: adding values, merging sketches in memory
+ * and merging serialized sketches the way a relay or collector would.
+ *
+ * Usage: sketch_bench [sketches] [values per sketch]
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pinba_sketch.h"
+
+static uint32_t rng_state = 2463534242U;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* request-like latencies: lognormal around 20ms with a slow tail */
+static double latency(void)
+{
+	double u1 = (rng() + 0.5) / 4294967296.0, u2 = (rng() + 0.5) / 4294967296.0;
+	double z = sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+
+	return 0.02 * exp(z);
+}
+
+int main(int argc, char **argv)
+{
+	int n_sketches = argc > 1 ? atoi(argv[1]) : 10000;
+	int n_values = argc > 2 ? atoi(argv[2]) : 100;
+	pinba_sketch *sketches, total, unpacked;
+	uint8_t **data;
+	size_t *len, bytes = 0;
+	int64_t start, elapsed;
+	int i, j;
+
+	sketches = malloc(sizeof(pinba_sketch) * n_sketches);
+	data = malloc(sizeof(uint8_t *) * n_sketches);
+	len = malloc(sizeof(size_t) * n_sketches);
+
+	start = now_ns();
+	for (i = 0; i < n_sketches; i++) {
+		pinba_sketch_init(&sketches[i], PINBA_SKETCH_DEFAULT_ALPHA);
+		for (j = 0; j < n_values; j++) {
+			pinba_sketch_add(&sketches[i], latency(), 1);
+		}
+	}
+	elapsed = now_ns() - start;
+	printf("add:               %8.1f ns/value\n", (double)elapsed / ((double)n_sketches * n_values));
+
+	for (i = 0; i < n_sketches; i++) {
+		len[i] = pinba_sketch_serialized_size(&sketches[i]);
+		data[i] = malloc(len[i]);
+		pinba_sketch_serialize(&sketches[i], data[i]);
+		bytes += len[i];
+	}
+	printf("serialized size:   %8.1f bytes/sketch (%d values)\n", (double)bytes / n_sketches, n_values);
+
+	pinba_sketch_init(&total, PINBA_SKETCH_DEFAULT_ALPHA);
+	start = now_ns();
+	for (i = 0; i < n_sketches; i++) {
+		pinba_sketch_merge(&total, &sketches[i]);
+	}
+	elapsed = now_ns() - start;
+	printf("merge:             %8.1f ns/sketch, %.0f sketches/s\n", (double)elapsed / n_sketches, n_sketches * 1e9 / elapsed);
+
+	pinba_sketch_reset(&total);
+	start = now_ns();
+	for (i = 0; i < n_sketches; i++) {
+		pinba_sketch_unserialize(&unpacked, data[i], len[i]);
+		pinba_sketch_merge(&total, &unpacked);
+		pinba_sketch_destroy(&unpacked);
+	}
+	elapsed = now_ns() - start;
+	printf("unserialize+merge: %8.1f ns/sketch, %.0f sketches/s\n", (double)elapsed / n_sketches, n_sketches * 1e9 / elapsed);
+
+	printf("p50 %.6f p99 %.6f p999 %.6f over %llu values\n", pinba_sketch_quantile(&total, 0.5),
+			pinba_sketch_quantile(&total, 0.99), pinba_sketch_quantile(&total, 0.999), (unsigned long long)total.count);
+
+	pinba_sketch_destroy(&total);
+	for (i = 0; i < n_sketches; i++) {
+		pinba_sketch_destroy(&sketches[i]);
+		free(data[i]);
+	}
+	free(sketches);
+	free(data);
+	free(len);
+	return 0;
+}
@@ -8,5 +8,5 @@ if test "$PHP_PINBA" != "no"; then
   AC_CHECK_HEADERS(malloc.h)
   PHP_CHECK_FUNC(mallinfo)
 
-  PHP_NEW_EXTENSION(pinba, pinba-pb-c.c pinba.c protobuf-c.c, $ext_shared,, -DNDEBUG)
+  PHP_NEW_EXTENSION(pinba, pinba-pb-c.c pinba.c pinba_sketch.c protobuf-c.c, $ext_shared,, -DNDEBUG -DPRINT_UNPACK_ERRORS=0)
 fi
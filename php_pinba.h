@@ -31,7 +31,8 @@ extern zend_module_entry pinba_module_entry;
 
 #define PINBA_COLLECTOR_DEFAULT_PORT "30002"
 #define PINBA_COLLECTORS_MAX 8
-#define PHP_PINBA_VERSION "1.1.2"
+#define PINBA_OBSERVE_DEPTH 64
+#define PHP_PINBA_VERSION "1.2.0-dev"
 
 typedef struct _pinba_req_data { /* {{{ */
 	char *server_name;
@@ -39,8 +40,7 @@ typedef struct _pinba_req_data { /* {{{ */
 	size_t req_count;
 	size_t doc_size;
 	size_t  mem_peak_usage;
-	struct timeval req_start;
-	struct timeval req_time;
+	int64_t req_start; /* nanoseconds */
 	struct timeval ru_utime;
 	struct timeval ru_stime;
 	size_t memory_footprint;
@@ -59,6 +59,32 @@ typedef struct _pinba_collector {
 	char *port;
 } pinba_collector;
 
+#define PINBA_ARENA_SMALL_MAX 512 /* blocks up to this size are reused by exact size class */
+#define PINBA_ARENA_FREE_LISTS (PINBA_ARENA_SMALL_MAX / ZEND_MM_ALIGNMENT + 1) /* the last one is for larger blocks */
+
+typedef struct _pinba_arena_chunk { /* {{{ */
+	struct _pinba_arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[1];
+} pinba_arena_chunk;
+/* }}} */
+
+typedef struct _pinba_arena { /* {{{ */
+	pinba_arena_chunk *first;
+	pinba_arena_chunk *current;
+	size_t chunk_size;
+	zend_bool persistent; /* persistent arenas keep their chunks across requests */
+	void *free_lists[PINBA_ARENA_FREE_LISTS]; /* blocks given back with php_pinba_arena_free() */
+} pinba_arena;
+/* }}} */
+
+typedef struct _pinba_timer_list { /* {{{ */
+	struct _pinba_timer *first;
+	struct _pinba_timer *last;
+} pinba_timer_list;
+/* }}} */
+
 ZEND_BEGIN_MODULE_GLOBALS(pinba) /* {{{ */
 	pinba_collector collectors[PINBA_COLLECTORS_MAX];
 	unsigned int n_collectors; /* number of collectors we got from ini file */
@@ -73,12 +99,36 @@ ZEND_BEGIN_MODULE_GLOBALS(pinba) /* {{{ */
 	double request_time;
 	HashTable timers;
 	HashTable tags;
+	HashTable measure_timers; /* pinba_measure() timers by tags fingerprint */
+	HashTable measure_literals; /* immutable tags arrays to measure_timers keys */
+	HashTable timers_folded; /* stopped timers dropped by the script summed up by tags fingerprint */
+	pinba_arena timers_arena; /* tags and histograms of timers, folded timers; reset at once at RSHUTDOWN */
+	struct _pinba_timer *overflow_timer; /* folded timers beyond pinba.max_timers tag sets */
+	zend_long max_timers;
+	HashTable dict; /* packet dictionary, words to ids + 1, filled as timers stop */
+	uint32_t dict_gen; /* bumped whenever dict is emptied */
+	HashTable db_links; /* database connections and statements by object handle, see pinba.auto_timers */
+	HashTable observed_functions; /* functions matching pinba.observe_functions by function pointer */
+	HashTable curl_handles; /* start times of the transfers added to multi handles by object handle */
+	int64_t observe_start[PINBA_OBSERVE_DEPTH]; /* start times of the observed calls in progress */
+	int observe_depth;
+	int autoload_depth; /* nested autoloads are timed as part of the outermost one */
+	pinba_timer_list timers_list; /* all timer resources, in order of creation */
+	pinba_timer_list running_timers_list; /* started timers only */
+	struct _pinba_timer *timer_stack_top; /* innermost running timer, see pinba.timer_nesting */
 	pinba_req_data tmp_req_data;
 	zend_bool timers_stopped;
 	zend_bool in_rshutdown;
 	zend_bool enabled;
 	zend_bool auto_flush;
+	zend_bool timer_nesting;
+	zend_bool timer_histograms;
+	zend_bool sketches;
 	time_t resolve_interval; /* seconds */
+	char *clock; /* pinba.clock, see pinba_clock_source */
+	char *timer_cpu; /* pinba.timer_cpu, see pinba_cpu_mode */
+	char *auto_timers; /* pinba.auto_timers, see pinba_auto_timers */
+	char *observe_functions; /* pinba.observe_functions, see pinba_observe_patterns */
 ZEND_END_MODULE_GLOBALS(pinba)
 /* }}} */
 
@@ -49,7 +49,7 @@ void   pinba__request__free_unpacked
   PROTOBUF_C_ASSERT (message->base.descriptor == &pinba__request__descriptor);
   protobuf_c_message_free_unpacked ((ProtobufCMessage*)message, allocator);
 }
-static const ProtobufCFieldDescriptor pinba__request__field_descriptors[23] =
+static const ProtobufCFieldDescriptor pinba__request__field_descriptors[33] =
 {
   {
     .name              = "hostname",
@@ -281,6 +281,106 @@ static const ProtobufCFieldDescriptor pinba__request__field_descriptors[23] =
     .descriptor        = NULL,
     .default_value     = NULL,
   },
+  {
+    .name              = "timer_parent",
+    .id                = 24,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_UINT32,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_parent),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_parent),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "timer_self_value",
+    .id                = 25,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_FLOAT,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_self_value),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_self_value),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "timer_hist_count",
+    .id                = 26,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_UINT32,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_hist_count),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_hist_count),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "timer_hist_bucket",
+    .id                = 27,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_UINT32,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_hist_bucket),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_hist_bucket),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "timer_hist_hits",
+    .id                = 28,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_UINT32,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_hist_hits),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_hist_hits),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "timer_min_value",
+    .id                = 29,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_FLOAT,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_min_value),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_min_value),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "timer_max_value",
+    .id                = 30,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_FLOAT,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_max_value),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_max_value),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "request_time_sketch",
+    .id                = 31,
+    .label             = PROTOBUF_C_LABEL_OPTIONAL,
+    .type              = PROTOBUF_C_TYPE_BYTES,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, has_request_time_sketch),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, request_time_sketch),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "timer_sketch",
+    .id                = 32,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_BYTES,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_sketch),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_sketch),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
+  {
+    .name              = "timer_counter",
+    .id                = 33,
+    .label             = PROTOBUF_C_LABEL_REPEATED,
+    .type              = PROTOBUF_C_TYPE_UINT64,
+    .quantifier_offset = PROTOBUF_C_OFFSETOF(Pinba__Request, n_timer_counter),
+    .offset            = PROTOBUF_C_OFFSETOF(Pinba__Request, timer_counter),
+    .descriptor        = NULL,
+    .default_value     = NULL,
+  },
 };
 static const unsigned pinba__request__field_indices_by_name[] = {
   14,   /* field[14] = dictionary */
@@ -290,6 +390,7 @@ static const unsigned pinba__request__field_indices_by_name[] = {
   5,   /* field[5] = memory_peak */
   3,   /* field[3] = request_count */
   6,   /* field[6] = request_time */
+  30,   /* field[30] = request_time_sketch */
   17,   /* field[17] = requests */
   8,   /* field[8] = ru_stime */
   7,   /* field[7] = ru_utime */
@@ -299,9 +400,18 @@ static const unsigned pinba__request__field_indices_by_name[] = {
   15,   /* field[15] = status */
   19,   /* field[19] = tag_name */
   20,   /* field[20] = tag_value */
+  32,   /* field[32] = timer_counter */
+  26,   /* field[26] = timer_hist_bucket */
+  25,   /* field[25] = timer_hist_count */
+  27,   /* field[27] = timer_hist_hits */
   9,   /* field[9] = timer_hit_count */
+  29,   /* field[29] = timer_max_value */
+  28,   /* field[28] = timer_min_value */
+  23,   /* field[23] = timer_parent */
   22,   /* field[22] = timer_ru_stime */
   21,   /* field[21] = timer_ru_utime */
+  24,   /* field[24] = timer_self_value */
+  31,   /* field[31] = timer_sketch */
   11,   /* field[11] = timer_tag_count */
   12,   /* field[12] = timer_tag_name */
   13,   /* field[13] = timer_tag_value */
@@ -310,7 +420,7 @@ static const unsigned pinba__request__field_indices_by_name[] = {
 static const ProtobufCIntRange pinba__request__number_ranges[1 + 1] =
 {
   { 1, 0 },
-  { 0, 23 }
+  { 0, 33 }
 };
 const ProtobufCMessageDescriptor pinba__request__descriptor =
 {
@@ -320,7 +430,7 @@ const ProtobufCMessageDescriptor pinba__request__descriptor =
   .c_name                = "Pinba__Request",
   .package_name          = "Pinba",
   .sizeof_message        = sizeof(Pinba__Request),
-  .n_fields              = 23,
+  .n_fields              = 33,
   .fields                = pinba__request__field_descriptors,
   .fields_sorted_by_name = pinba__request__field_indices_by_name,
   .n_field_ranges        = 1,
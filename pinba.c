@@ -31,12 +31,24 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 
 #include "php.h"
 #include "php_ini.h"
 #include "SAPI.h"
 #include "ext/standard/info.h"
 #include "ext/standard/php_array.h"
+#include "zend_interfaces.h"
+
+/* automatic timers observe calls, internal functions can be observed since PHP 8.2 */
+#if PHP_VERSION_ID >= 80000
+# define PINBA_HAVE_OBSERVER 1
+# include "zend_observer.h"
+#endif
+#if PHP_VERSION_ID >= 80200
+# define PINBA_OBSERVE_INTERNAL 1
+#endif
 
 #ifdef HAVE_MALLOC_H
 # include <malloc.h>
@@ -45,10 +57,16 @@
 #include "php_pinba.h"
 
 #include "pinba.pb-c.h"
+#include "pinba_sketch.h"
 
 zend_class_entry *pinba_client_ce;
 static zend_object_handlers pinba_client_handlers;
 
+zend_class_entry *pinba_timer_ce;
+static zend_object_handlers pinba_timer_handlers;
+zend_class_entry *pinba_tagset_ce;
+static zend_object_handlers pinba_tagset_handlers;
+
 typedef struct {
 	char **servers;
 	int n_servers;
@@ -79,7 +97,6 @@ ZEND_DECLARE_MODULE_GLOBALS(pinba)
 ZEND_GET_MODULE(pinba)
 #endif
 
-static int le_pinba_timer;
 size_t (*old_sapi_ub_write) (const char *, size_t);
 
 #if ZEND_MODULE_API_NO > 20020429
@@ -95,44 +112,165 @@ size_t (*old_sapi_ub_write) (const char *, size_t);
 
 static HashTable resolver_cache;
 
+#define PINBA_TIMERS_ARENA_CHUNK_SIZE 65536
+#define PINBA_DECODE_CHUNK_SIZE 8192
+#define PINBA_DECODE_MAX_DEPTH 16
+#define PINBA_OVERFLOW_TAG "__overflow__"
+
 typedef struct _pinba_timer_tag { /* {{{ */
-	char *name;
-	int name_len;
+	unsigned int name_offset; /* offsets into the string blob following the tags */
+	unsigned int name_len;
+	unsigned int value_offset;
+	unsigned int value_len; /* we cast all types to string */
 	int name_id;
-	char *value; /* we cast all types to string */
-	int value_len;
 	int value_id;
 } pinba_timer_tag_t;
 /* }}} */
 
+/* all tags of a timer live in one allocation: the header, the tags sorted by name
+   and a blob of NUL-terminated names and values */
+typedef struct _pinba_timer_tags { /* {{{ */
+	int num;
+	zend_ulong hash; /* fingerprint of the sorted tags, see php_pinba_tags_hash() */
+	size_t blob_len;
+	uint32_t dict_gen; /* name_id and value_id are valid for this PINBA_G(dict_gen), 0 if not assigned */
+	pinba_timer_tag_t tag[1];
+} pinba_timer_tags_t;
+/* }}} */
+
+#define PINBA_TAGS_BLOB(tags) ((char *)((tags)->tag + (tags)->num))
+#define PINBA_TAG_NAME(tags, i) (PINBA_TAGS_BLOB(tags) + (tags)->tag[i].name_offset)
+#define PINBA_TAG_VALUE(tags, i) (PINBA_TAGS_BLOB(tags) + (tags)->tag[i].value_offset)
+/* opcache keeps literal arrays immutable in shared memory, they outlive the request */
+#if PHP_VERSION_ID >= 70300
+# define PINBA_ARRAY_IS_IMMUTABLE(ht) ((GC_FLAGS(ht) & GC_IMMUTABLE) != 0)
+#else
+# define PINBA_ARRAY_IS_IMMUTABLE(ht) ((GC_FLAGS(ht) & IS_ARRAY_IMMUTABLE) != 0)
+#endif
+
+#define PINBA_TAGS_SIZE(num, blob_len) (XtOffsetOf(pinba_timer_tags_t, tag) + (num) * sizeof(pinba_timer_tag_t) + (blob_len))
+
+/* log-linear histogram of hit durations in microseconds: values below PINBA_HISTOGRAM_SUB_COUNT
+   get a bucket each, every following power of two is split into PINBA_HISTOGRAM_SUB_COUNT buckets */
+#define PINBA_HISTOGRAM_SUB_BITS 3
+#define PINBA_HISTOGRAM_SUB_COUNT (1 << PINBA_HISTOGRAM_SUB_BITS)
+#define PINBA_HISTOGRAM_MAX_BITS 32 /* ~71 minutes, longer hits go to the last bucket */
+#define PINBA_HISTOGRAM_BUCKETS ((PINBA_HISTOGRAM_MAX_BITS - PINBA_HISTOGRAM_SUB_BITS + 1) * PINBA_HISTOGRAM_SUB_COUNT)
+
+typedef struct _pinba_histogram { /* {{{ */
+	uint64_t hits;
+	int64_t min; /* nanoseconds */
+	int64_t max;
+	uint32_t counts[PINBA_HISTOGRAM_BUCKETS];
+} pinba_histogram;
+/* }}} */
+
+typedef struct _pinba_timer_link { /* {{{ */
+	struct _pinba_timer *prev;
+	struct _pinba_timer *next;
+} pinba_timer_link;
+/* }}} */
+
 typedef struct _pinba_timer { /* {{{ */
-	int rsrc_id;
+	pinba_timer_link link; /* PINBA_G(timers_list) */
+	pinba_timer_link running_link; /* PINBA_G(running_timers_list) */
 	unsigned int started:1;
 	unsigned int hit_count;
-	pinba_timer_tag_t **tags;
-	int tags_num;
-	struct {
-		int tv_sec;
-		int tv_usec;
-	} start;
-	struct {
-		int tv_sec;
-		int tv_usec;
-	} value;
+	pinba_timer_tags_t *tags;
+	int64_t start; /* nanoseconds, see php_pinba_clock_ns() */
+	int64_t value; /* nanoseconds */
 	zval data;
-	struct timeval tmp_ru_utime;
-	struct timeval tmp_ru_stime;
-	struct timeval ru_utime;
-	struct timeval ru_stime;
+	int64_t tmp_ru_utime; /* CPU time at start, nanoseconds */
+	int64_t tmp_ru_stime;
+	int64_t ru_utime;
+	int64_t ru_stime;
+	unsigned int cpu:1; /* measure CPU time, see pinba.timer_cpu */
+	struct _pinba_timer *parent; /* enclosing timer when pinba.timer_nesting is on, holds a reference */
+	struct _pinba_timer *stack_prev; /* PINBA_G(timer_stack_top) before this one was pushed, holds a reference */
+	int64_t children_value; /* time spent in child timers, nanoseconds */
+	int packet_index; /* aggregate index while a packet is being created, -1 otherwise */
+	pinba_histogram *hist; /* durations of single hits for pinba_measure() timers, see pinba.timer_histograms */
+	pinba_sketch *sketch; /* the same as a quantile sketch, see pinba.sketches */
 	unsigned deleted:1;
+	unsigned linked:1; /* on PINBA_G(timers_list), which holds a reference to the object unless weak is set */
+	unsigned weak:1; /* stopped and folded once the script drops it, see php_pinba_timer_fold() */
+	unsigned counter:1; /* sends count in timer_counter instead of a time, see php_pinba_auto_count() */
+	uint64_t count;
 } pinba_timer_t;
 /* }}} */
 
-#define PHP_ZVAL_TO_TIMER(zval, timer) \
-	            timer = (pinba_timer_t *)zend_fetch_resource(Z_RES_P(zval), "pinba timer", le_pinba_timer);	\
-				if (!timer) {																		\
-					RETURN_FALSE;																	\
-				}
+/* timers with the same tags (and parent) summed up for a packet */
+typedef struct _pinba_timer_agg { /* {{{ */
+	pinba_timer_tags_t *tags;
+	unsigned int parent; /* index of the parent aggregate + 1, 0 for top-level timers */
+	unsigned int hit_count;
+	int64_t value;
+	int64_t self_value;
+	int64_t ru_utime;
+	int64_t ru_stime;
+	pinba_histogram *hist;
+	pinba_sketch *sketch;
+	unsigned counter:1;
+	uint64_t count;
+} pinba_timer_agg;
+/* }}} */
+
+/* PinbaTimer objects embed the timer, PinbaClient keeps bare pinba_timer_t */
+typedef struct _pinba_timer_object { /* {{{ */
+	pinba_timer_t timer;
+	zend_object std;
+} pinba_timer_object;
+/* }}} */
+
+/* PinbaTagSet objects keep tags converted once by pinba_tagset_create(), they never change */
+typedef struct _pinba_tagset_object { /* {{{ */
+	pinba_timer_tags_t *tags;
+	zend_object std;
+} pinba_tagset_object;
+/* }}} */
+
+/* intrusive lists of timers, so that we don't have to scan EG(regular_list) */
+#define PINBA_TIMER_LIST_APPEND(list, t, member) do {	\
+		(t)->member.prev = (list).last;					\
+		(t)->member.next = NULL;						\
+		if ((list).last) {								\
+			(list).last->member.next = (t);				\
+		} else {										\
+			(list).first = (t);							\
+		}												\
+		(list).last = (t);								\
+	} while (0)
+
+#define PINBA_TIMER_LIST_REMOVE(list, t, member) do {	\
+		if ((t)->member.prev) {							\
+			(t)->member.prev->member.next = (t)->member.next;	\
+		} else {										\
+			(list).first = (t)->member.next;			\
+		}												\
+		if ((t)->member.next) {							\
+			(t)->member.next->member.prev = (t)->member.prev;	\
+		} else {										\
+			(list).last = (t)->member.prev;				\
+		}												\
+		(t)->member.prev = (t)->member.next = NULL;		\
+	} while (0)
+
+static inline pinba_timer_object *php_pinba_timer_object(zend_object *obj) {
+	return (pinba_timer_object *)((char*)(obj) - XtOffsetOf(pinba_timer_object, std));
+}
+
+static inline pinba_tagset_object *php_pinba_tagset_object(zend_object *obj) {
+	return (pinba_tagset_object *)((char*)(obj) - XtOffsetOf(pinba_tagset_object, std));
+}
+
+#define PINBA_TIMER_ZOBJ(t) (&((pinba_timer_object *)(t))->std)
+#if PHP_VERSION_ID < 70300
+# define PINBA_GC_ADDREF(p) GC_REFCOUNT(p)++
+#else
+# define PINBA_GC_ADDREF(p) GC_ADDREF(p)
+#endif
+
+#define PHP_ZVAL_TO_TIMER(zv, t) t = &php_pinba_timer_object(Z_OBJ_P(zv))->timer
 
 static inline pinba_client_t  *php_pinba_client_object(zend_object *obj) {
 	return (pinba_client_t *)((char*)(obj) - XtOffsetOf(pinba_client_t, std));
@@ -142,11 +280,7 @@ static inline pinba_client_t  *php_pinba_client_object(zend_object *obj) {
 
 #define timeval_cvt(a, b) do { (a)->tv_sec = (b)->tv_sec; (a)->tv_usec = (b)->tv_usec; } while (0);
 #define timeval_to_float(t) (float)(t).tv_sec + (float)(t).tv_usec / 1000000.0
-#define float_to_timeval(f, t)										\
-	do {															\
-		(t).tv_sec = (int)(f);										\
-		(t).tv_usec = (int)((f - (double)(t).tv_sec) * 1000000.0);	\
-	} while(0);
+#define timeval_to_ns(t) ((int64_t)(t).tv_sec * 1000000000LL + (int64_t)(t).tv_usec * 1000)
 
 #ifndef timersub
 # define timersub(a, b, result)										\
@@ -172,283 +306,1779 @@ static inline pinba_client_t  *php_pinba_client_object(zend_object *obj) {
 	} while (0)
 #endif
 
+#define PINBA_NSEC_PER_SEC 1000000000LL
+#define ns_to_float(ns) ((double)(ns) / 1000000000.0)
+#define float_to_ns(f) ((int64_t)((f) * 1000000000.0))
+
+#define PINBA_CLOCK_MONOTONIC 0
+#define PINBA_CLOCK_MONOTONIC_COARSE 1
+#define PINBA_CLOCK_TSC 2
+
+static const char *pinba_clock_names[] = { "monotonic", "monotonic_coarse", "tsc" };
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define PINBA_HAVE_TSC 1
+# include <cpuid.h>
+#endif
+
+#define PINBA_CPU_RUSAGE 0
+#define PINBA_CPU_THREAD 1
+#define PINBA_CPU_OFF 2
+
+static const char *pinba_cpu_names[] = { "rusage", "thread", "off" };
+
+/* pinba.auto_timers, bits in the order of pinba_auto_timer_names */
+#define PINBA_AUTO_PDO (1 << 0)
+#define PINBA_AUTO_MYSQLI (1 << 1)
+#define PINBA_AUTO_CURL (1 << 2)
+#define PINBA_AUTO_COMPILE (1 << 3)
+#define PINBA_AUTO_AUTOLOAD (1 << 4)
+#define PINBA_AUTO_GC (1 << 5)
+
+static const char *pinba_auto_timer_names[] = { "pdo", "mysqli", "curl", "compile", "autoload", "gc" };
+
+#define PINBA_AUTO_TIMERS_NUM (sizeof(pinba_auto_timer_names) / sizeof(pinba_auto_timer_names[0]))
+
+/* sources timed through the observer API, the others wrap engine hooks */
+#define PINBA_AUTO_OBSERVED (PINBA_AUTO_PDO | PINBA_AUTO_MYSQLI | PINBA_AUTO_CURL)
+
+#ifdef PINBA_OBSERVE_INTERNAL
+# define PINBA_AUTO_SUPPORTED (PINBA_AUTO_OBSERVED | PINBA_AUTO_COMPILE | PINBA_AUTO_AUTOLOAD | PINBA_AUTO_GC)
+#elif PHP_VERSION_ID >= 80000
+# define PINBA_AUTO_SUPPORTED (PINBA_AUTO_COMPILE | PINBA_AUTO_AUTOLOAD | PINBA_AUTO_GC)
+#else
+# define PINBA_AUTO_SUPPORTED (PINBA_AUTO_COMPILE | PINBA_AUTO_GC)
+#endif
+
+/* in ZTS builds RUSAGE_SELF would include the CPU time of all threads */
+#if defined(ZTS) && defined(RUSAGE_THREAD)
+# define PINBA_RUSAGE_WHO RUSAGE_THREAD
+#else
+# define PINBA_RUSAGE_WHO RUSAGE_SELF
+#endif
+
+typedef struct _pinba_cpu_sample { /* {{{ */
+	int64_t utime; /* nanoseconds */
+	int64_t stime;
+} pinba_cpu_sample;
+/* }}} */
+
+/* pinba.clock, pinba.timer_cpu and pinba.auto_timers are PHP_INI_SYSTEM, so these are process-wide */
+static int pinba_cpu_mode = PINBA_CPU_RUSAGE;
+static int pinba_auto_timers = 0;
+
+/* pinba.observe_functions, "Class::method", "Class::*" or "function" */
+typedef struct _pinba_observe_pattern { /* {{{ */
+	char *class_name; /* NULL for functions */
+	size_t class_len;
+	char *name; /* NULL for all methods of the class */
+	size_t name_len;
+} pinba_observe_pattern;
+/* }}} */
+
+static pinba_observe_pattern *pinba_observe_patterns = NULL;
+static int pinba_observe_patterns_num = 0;
+static int pinba_clock_source = PINBA_CLOCK_MONOTONIC;
+static clockid_t pinba_clock_id = CLOCK_MONOTONIC;
+#ifdef PINBA_HAVE_TSC
+static uint64_t pinba_tsc_base;
+static int64_t pinba_tsc_base_ns;
+static double pinba_tsc_ns_per_tick;
+#endif
+
 static int php_pinba_key_compare(const void *a, const void *b);
 
 /* {{{ internal funcs */
 
+static inline int64_t php_pinba_clock_gettime(clockid_t clock_id) /* {{{ */
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock_id, &ts) != 0) {
+		return 0;
+	}
+	return (int64_t)ts.tv_sec * PINBA_NSEC_PER_SEC + ts.tv_nsec;
+}
+/* }}} */
+
+/* monotonic time in nanoseconds from the clock selected with pinba.clock */
+static inline int64_t php_pinba_clock_ns(void) /* {{{ */
+{
+#ifdef PINBA_HAVE_TSC
+	if (pinba_clock_source == PINBA_CLOCK_TSC) {
+		return pinba_tsc_base_ns + (int64_t)((double)(__builtin_ia32_rdtsc() - pinba_tsc_base) * pinba_tsc_ns_per_tick);
+	}
+#endif
+	return php_pinba_clock_gettime(pinba_clock_id);
+}
+/* }}} */
+
+/* CPU time used so far as configured with pinba.timer_cpu */
+static inline int php_pinba_cpu_sample(pinba_cpu_sample *sample) /* {{{ */
+{
+	struct rusage u;
+
+	switch (pinba_cpu_mode) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+		case PINBA_CPU_THREAD:
+			/* user and system time combined, reported as user time */
+			sample->utime = php_pinba_clock_gettime(CLOCK_THREAD_CPUTIME_ID);
+			sample->stime = 0;
+			return SUCCESS;
+#endif
+		case PINBA_CPU_RUSAGE:
+			if (getrusage(PINBA_RUSAGE_WHO, &u) != 0) {
+				return FAILURE;
+			}
+			sample->utime = timeval_to_ns(u.ru_utime);
+			sample->stime = timeval_to_ns(u.ru_stime);
+			return SUCCESS;
+		default:
+			return FAILURE;
+	}
+}
+/* }}} */
+
+#ifdef PINBA_HAVE_TSC
+static int php_pinba_tsc_calibrate(void) /* {{{ */
+{
+	unsigned int eax, ebx, ecx, edx;
+	struct timespec delay = {0, 10000000}; /* 10ms */
+	uint64_t tsc_start, tsc_end;
+	int64_t ns_start, ns_end;
+
+	/* only an invariant TSC ticks at a constant rate in all power states */
+	if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1 << 8))) {
+		return FAILURE;
+	}
+
+	ns_start = php_pinba_clock_gettime(CLOCK_MONOTONIC);
+	tsc_start = __builtin_ia32_rdtsc();
+	nanosleep(&delay, NULL);
+	ns_end = php_pinba_clock_gettime(CLOCK_MONOTONIC);
+	tsc_end = __builtin_ia32_rdtsc();
+
+	if (tsc_end <= tsc_start || ns_end <= ns_start) {
+		return FAILURE;
+	}
+
+	pinba_tsc_ns_per_tick = (double)(ns_end - ns_start) / (double)(tsc_end - tsc_start);
+	pinba_tsc_base = tsc_end;
+	pinba_tsc_base_ns = ns_end;
+	return SUCCESS;
+}
+/* }}} */
+#endif
+
 static inline pinba_collector* php_pinba_collector_add(pinba_collector *collectors, unsigned int *n_collectors) /* {{{ */
 {
 	if (*n_collectors >= PINBA_COLLECTORS_MAX) {
 		return NULL;
 	}
 
-	return &collectors[(*n_collectors)++];
+	return &collectors[(*n_collectors)++];
+}
+/* }}} */
+
+static inline void php_pinba_cleanup_collectors(pinba_collector *collectors, unsigned int *n_collectors) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < *n_collectors; i++) {
+		pinba_collector *collector = &collectors[i];
+
+		if (collector->host) {
+			free(collector->host);
+		}
+
+		if (collector->port) {
+			free(collector->port);
+		}
+	}
+	*n_collectors = 0;
+}
+/* }}} */
+
+static inline int php_pinba_parse_server(char *address, char **host, char **port) /* {{{ */
+{
+	char *new_node, *new_service = NULL;
+
+	*host = *port = NULL;
+
+	if (address[0] == 0) { /* empty string, just skip */
+		return FAILURE;
+	}
+
+	/* '[' <node> ']' [':' <service>] */
+	if (address[0] == '[') {
+		char *endptr;
+
+		new_node = address + 1;
+
+		endptr = strchr(new_node, ']');
+		if (endptr == NULL) {
+			return FAILURE;
+		}
+		*endptr = 0;
+		endptr++;
+
+		if (*endptr != ':' && *endptr != 0) {
+			return FAILURE;
+		}
+
+		if (*endptr != 0) {
+			new_service = endptr + 1;
+		}
+
+		if (new_service != NULL && *new_service == 0) {
+			new_service = NULL;
+		}
+	}
+	/* <ipv4 node> [':' <service>] */
+	else if ((strchr(address, ':') == NULL) /* no colon */
+			|| (strchr(address, ':') == strrchr(address, ':'))) { /* exactly one colon */
+		char *endptr = strchr(address, ':');
+
+		if (endptr != NULL) {
+			*endptr = 0;
+			new_service = endptr + 1;
+		}
+		new_node = address;
+	}
+	/* <ipv6 node> */
+	else { /* multiple colons */
+		new_node = address;
+	}
+	*host = new_node;
+	*port = new_service;
+	return SUCCESS;
+}
+/* }}} */
+
+/* the innermost running timer becomes the parent of new timers, see pinba.timer_nesting */
+static inline void php_pinba_timer_set_parent(pinba_timer_t *t) /* {{{ */
+{
+	pinba_timer_t *parent = PINBA_G(timer_stack_top);
+
+	if (parent) {
+		t->parent = parent;
+		PINBA_GC_ADDREF(PINBA_TIMER_ZOBJ(parent));
+	}
+}
+/* }}} */
+
+/* the stack is kept apart from the parents: a restarted timer keeps the parent of its first run,
+   but the timers running when it was restarted are the ones to get back to when it stops */
+static void php_pinba_timer_stack_push(pinba_timer_t *t) /* {{{ */
+{
+	pinba_timer_t *top = PINBA_G(timer_stack_top), *above;
+
+	/* a timer stopped out of order is still in the chain, take it out before pushing it again */
+	for (above = top; above; above = above->stack_prev) {
+		if (above->stack_prev == t) {
+			above->stack_prev = t->stack_prev;
+			t->stack_prev = NULL;
+			OBJ_RELEASE(PINBA_TIMER_ZOBJ(t));
+			break;
+		}
+	}
+
+	if (top) {
+		t->stack_prev = top;
+		PINBA_GC_ADDREF(PINBA_TIMER_ZOBJ(top));
+	}
+	PINBA_G(timer_stack_top) = t;
+}
+/* }}} */
+
+static void php_pinba_timer_stack_pop(pinba_timer_t *t) /* {{{ */
+{
+	pinba_timer_t *top = t->stack_prev, *prev;
+
+	t->stack_prev = NULL;
+	/* timers stopped out of order stay in the chain until the timers above them are stopped */
+	while (top && !top->started) {
+		prev = top->stack_prev;
+		top->stack_prev = NULL;
+		OBJ_RELEASE(PINBA_TIMER_ZOBJ(top));
+		top = prev;
+	}
+	/* running timers are kept by PINBA_G(running_timers_list) */
+	if (top) {
+		OBJ_RELEASE(PINBA_TIMER_ZOBJ(top));
+	}
+	PINBA_G(timer_stack_top) = top;
+}
+/* }}} */
+
+static inline int php_pinba_dict_find_or_add(HashTable *ht, char *word, size_t word_len) /* {{{ */
+{
+	size_t id, cnt;
+
+	id = (size_t)zend_hash_str_find_ptr(ht, word, word_len);
+	if (!id) {
+		cnt = zend_hash_num_elements(ht) + 1;
+
+		if (zend_hash_str_add_ptr(ht, word, word_len, (void *)cnt) == NULL) {
+			return -1;
+		}
+		return cnt - 1;
+	}
+	return id - 1;
+}
+/* }}} */
+
+/* Assign the dictionary ids to the tags unless they have them already for this generation of the dictionary.
+   Stopped timers are encoded as they stop, so most tag sets have their ids by the time the packet is built. */
+static int php_pinba_tags_encode(pinba_timer_tags_t *tags, HashTable *dict, uint32_t gen) /* {{{ */
+{
+	int i, word_id;
+
+	if (gen && tags->dict_gen == gen) {
+		return SUCCESS;
+	}
+
+	for (i = 0; i < tags->num; i++) {
+		word_id = php_pinba_dict_find_or_add(dict, PINBA_TAG_NAME(tags, i), tags->tag[i].name_len);
+		if (word_id < 0) {
+			return FAILURE;
+		}
+		tags->tag[i].name_id = word_id;
+
+		word_id = php_pinba_dict_find_or_add(dict, PINBA_TAG_VALUE(tags, i), tags->tag[i].value_len);
+		if (word_id < 0) {
+			return FAILURE;
+		}
+		tags->tag[i].value_id = word_id;
+	}
+	tags->dict_gen = gen;
+	return SUCCESS;
+}
+/* }}} */
+
+/* the ids already assigned to timers are invalid from now on */
+static void php_pinba_dict_reset(void) /* {{{ */
+{
+	zend_hash_clean(&PINBA_G(dict));
+	if (++PINBA_G(dict_gen) == 0) {
+		PINBA_G(dict_gen) = 1;
+	}
+}
+/* }}} */
+
+static inline int php_pinba_timer_stop(pinba_timer_t *t, const int64_t *pnow, const pinba_cpu_sample *pcpu) /* {{{ */
+{
+	pinba_cpu_sample cpu;
+	int64_t elapsed;
+
+	if (!t->started) {
+		return FAILURE;
+	}
+
+	/* restarted timers add up their runs */
+	elapsed = (pnow ? *pnow : php_pinba_clock_ns()) - t->start;
+	t->value += elapsed;
+	if (t->parent) {
+		t->parent->children_value += elapsed;
+	}
+
+	if (t->cpu) {
+		if (!pcpu && php_pinba_cpu_sample(&cpu) == SUCCESS) {
+			pcpu = &cpu;
+		}
+		if (pcpu) {
+			t->ru_utime += pcpu->utime - t->tmp_ru_utime;
+			t->ru_stime += pcpu->stime - t->tmp_ru_stime;
+		}
+	}
+
+	t->started = 0;
+	PINBA_TIMER_LIST_REMOVE(PINBA_G(running_timers_list), t, running_link);
+	if (PINBA_G(timer_stack_top) == t) {
+		php_pinba_timer_stack_pop(t);
+	}
+
+	if (t->tags && !PINBA_G(in_rshutdown)) {
+		php_pinba_tags_encode(t->tags, &PINBA_G(dict), PINBA_G(dict_gen));
+	}
+	return SUCCESS;
+}
+/* }}} */
+
+/* Chunked allocator: blocks are carved from the chunks one after another and freed all at once by
+   php_pinba_arena_reset(), which keeps the chunks. Every block starts with its size, so blocks given back
+   with php_pinba_arena_free() (a retagged timer's old tags) are reused for the next block of that size. */
+#define PINBA_ARENA_HEADER ZEND_MM_ALIGNED_SIZE(sizeof(size_t))
+#define PINBA_ARENA_BLOCK_SIZE(ptr) (*(size_t *)((char *)(ptr) - PINBA_ARENA_HEADER))
+#define PINBA_ARENA_FREE_LIST(size) ((size) <= PINBA_ARENA_SMALL_MAX ? (size) / ZEND_MM_ALIGNMENT - 1 : PINBA_ARENA_FREE_LISTS - 1)
+#define PINBA_ARENA_NEXT_FREE(ptr) (*(void **)(ptr))
+
+static void php_pinba_arena_init(pinba_arena *arena, size_t chunk_size, zend_bool persistent) /* {{{ */
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size;
+	arena->persistent = persistent;
+}
+/* }}} */
+
+static void *php_pinba_arena_alloc(pinba_arena *arena, size_t size) /* {{{ */
+{
+	pinba_arena_chunk *chunk = arena->current;
+	void **link;
+	char *ptr;
+
+	size = ZEND_MM_ALIGNED_SIZE(MAX(size, sizeof(void *)));
+
+	/* small blocks come back in their own size class, larger ones take the first that is big enough */
+	for (link = &arena->free_lists[PINBA_ARENA_FREE_LIST(size)]; *link; link = &PINBA_ARENA_NEXT_FREE(*link)) {
+		if (PINBA_ARENA_BLOCK_SIZE(*link) >= size) {
+			ptr = *link;
+			*link = PINBA_ARENA_NEXT_FREE(ptr);
+			return ptr;
+		}
+	}
+
+	/* chunks kept by php_pinba_arena_reset() follow the current one */
+	while (chunk && chunk->size - chunk->used < PINBA_ARENA_HEADER + size) {
+		chunk = chunk->next;
+	}
+
+	if (!chunk) {
+		size_t chunk_size = MAX(PINBA_ARENA_HEADER + size, arena->chunk_size);
+
+		chunk = pemalloc(XtOffsetOf(pinba_arena_chunk, data) + chunk_size, arena->persistent);
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		if (arena->current) {
+			chunk->next = arena->current->next;
+			arena->current->next = chunk;
+		} else {
+			chunk->next = arena->first;
+			arena->first = chunk;
+		}
+	}
+	arena->current = chunk;
+
+	ptr = chunk->data + chunk->used + PINBA_ARENA_HEADER;
+	chunk->used += PINBA_ARENA_HEADER + size;
+	PINBA_ARENA_BLOCK_SIZE(ptr) = size;
+	return ptr;
+}
+/* }}} */
+
+static void php_pinba_arena_free(pinba_arena *arena, void *ptr) /* {{{ */
+{
+	void **list = &arena->free_lists[PINBA_ARENA_FREE_LIST(PINBA_ARENA_BLOCK_SIZE(ptr))];
+
+	PINBA_ARENA_NEXT_FREE(ptr) = *list;
+	*list = ptr;
+}
+/* }}} */
+
+static void php_pinba_arena_reset(pinba_arena *arena) /* {{{ */
+{
+	pinba_arena_chunk *chunk;
+
+	/* keep the chunks, the next request is likely to need as many */
+	for (chunk = arena->first; chunk; chunk = chunk->next) {
+		chunk->used = 0;
+	}
+	arena->current = arena->first;
+	memset(arena->free_lists, 0, sizeof(arena->free_lists));
+}
+/* }}} */
+
+static void php_pinba_arena_destroy(pinba_arena *arena) /* {{{ */
+{
+	pinba_arena_chunk *chunk, *next;
+
+	for (chunk = arena->first; chunk; chunk = next) {
+		next = chunk->next;
+		pefree(chunk, arena->persistent);
+	}
+	arena->first = NULL;
+	arena->current = NULL;
+	memset(arena->free_lists, 0, sizeof(arena->free_lists));
+}
+/* }}} */
+
+/* Timers keep their tags and histograms in PINBA_G(timers_arena), reset in one step at RSHUTDOWN.
+   Timer objects freed after that leave their blocks alone, they are already gone with the reset. */
+static inline void *php_pinba_timers_alloc(size_t size) /* {{{ */
+{
+	return php_pinba_arena_alloc(&PINBA_G(timers_arena), size);
+}
+/* }}} */
+
+static inline void *php_pinba_timers_calloc(size_t size) /* {{{ */
+{
+	return memset(php_pinba_arena_alloc(&PINBA_G(timers_arena), size), 0, size);
+}
+/* }}} */
+
+static inline void php_pinba_timers_free(void *ptr) /* {{{ */
+{
+	if (!PINBA_G(in_rshutdown)) {
+		php_pinba_arena_free(&PINBA_G(timers_arena), ptr);
+	}
+}
+/* }}} */
+
+/* bare timers of PinbaClient, their tags are emalloc()ed */
+static void php_pinba_timer_dtor(pinba_timer_t *t) /* {{{ */
+{
+	if (t->tags) {
+		efree(t->tags);
+	}
+	if (t->hist) {
+		efree(t->hist);
+	}
+	if (t->sketch) {
+		pinba_sketch_destroy(t->sketch);
+		efree(t->sketch);
+	}
+}
+/* }}} */
+
+static void php_timer_hash_dtor(zval *zv) /* {{{ */
+{
+	pinba_timer_t *t = Z_PTR_P(zv);
+
+	if (t) {
+		php_pinba_timer_dtor(t);
+		efree(t);
+	}
+}
+/* }}} */
+
+/* PINBA_G(timers_folded) timers live in PINBA_G(timers_arena) with their tags */
+static void php_folded_hash_dtor(zval *zv) /* {{{ */
+{
+	pinba_timer_t *t = Z_PTR_P(zv);
+
+	if (t->sketch) {
+		pinba_sketch_destroy(t->sketch);
+		efree(t->sketch);
+	}
+	if (t->hist) {
+		php_pinba_timers_free(t->hist);
+	}
+	php_pinba_timers_free(t->tags);
+	php_pinba_timers_free(t);
+}
+/* }}} */
+
+static void php_measure_hash_dtor(zval *zv) /* {{{ */
+{
+	pinba_timer_t *t = Z_PTR_P(zv);
+
+	OBJ_RELEASE(PINBA_TIMER_ZOBJ(t));
+}
+/* }}} */
+
+static void php_tag_hash_dtor(zval *zv) /* {{{ */
+{
+	char *tag = Z_PTR_P(zv);
+
+	if (tag) {
+		efree(tag);
+	}
+}
+/* }}} */
+
+static inline void php_pinba_tags_set(pinba_timer_tags_t *tags, int i, size_t *blob_pos, const char *name, size_t name_len, const char *value, size_t value_len) /* {{{ */
+{
+	char *blob = PINBA_TAGS_BLOB(tags);
+	pinba_timer_tag_t *tag = &tags->tag[i];
+
+	tag->name_offset = *blob_pos;
+	tag->name_len = name_len;
+	memcpy(blob + *blob_pos, name, name_len);
+	blob[*blob_pos + name_len] = '\0';
+	*blob_pos += name_len + 1;
+
+	tag->value_offset = *blob_pos;
+	tag->value_len = value_len;
+	memcpy(blob + *blob_pos, value, value_len);
+	blob[*blob_pos + value_len] = '\0';
+	*blob_pos += value_len + 1;
+
+	tag->name_id = tag->value_id = 0;
+}
+/* }}} */
+
+static inline void php_pinba_tags_hash(pinba_timer_tags_t *tags) /* {{{ */
+{
+	/* names and values are NUL-terminated and sorted by name, so the blob describes the whole tag set */
+	tags->hash = zend_hash_func(PINBA_TAGS_BLOB(tags), tags->blob_len);
+}
+/* }}} */
+
+static int php_pinba_tags_equal(pinba_timer_tags_t *a, pinba_timer_tags_t *b) /* {{{ */
+{
+	int i;
+
+	if (a == b) {
+		return 1;
+	}
+
+	if (a->hash != b->hash || a->num != b->num || a->blob_len != b->blob_len) {
+		return 0;
+	}
+
+	if (memcmp(PINBA_TAGS_BLOB(a), PINBA_TAGS_BLOB(b), a->blob_len) != 0) {
+		return 0;
+	}
+
+	/* names and values may contain NUL bytes themselves */
+	for (i = 0; i < a->num; i++) {
+		if (a->tag[i].name_len != b->tag[i].name_len) {
+			return 0;
+		}
+	}
+	return 1;
+}
+/* }}} */
+
+static inline unsigned int php_pinba_histogram_bucket(int64_t value) /* {{{ */
+{
+	uint64_t v = value > 0 ? (uint64_t)value / 1000 : 0;
+	int e;
+
+	if (v < PINBA_HISTOGRAM_SUB_COUNT) {
+		return (unsigned int)v;
+	}
+
+	if (v >> PINBA_HISTOGRAM_MAX_BITS) {
+		return PINBA_HISTOGRAM_BUCKETS - 1;
+	}
+
+#if defined(__GNUC__)
+	e = 63 - __builtin_clzll(v);
+#else
+	for (e = PINBA_HISTOGRAM_SUB_BITS; (v >> (e + 1)) != 0; e++);
+#endif
+	return ((e - PINBA_HISTOGRAM_SUB_BITS + 1) << PINBA_HISTOGRAM_SUB_BITS) + ((v >> (e - PINBA_HISTOGRAM_SUB_BITS)) & (PINBA_HISTOGRAM_SUB_COUNT - 1));
+}
+/* }}} */
+
+static inline void php_pinba_histogram_add(pinba_histogram *hist, int64_t value, unsigned int hits) /* {{{ */
+{
+	if (hist->hits == 0 || value < hist->min) {
+		hist->min = value;
+	}
+	if (hist->hits == 0 || value > hist->max) {
+		hist->max = value;
+	}
+	hist->hits += hits;
+	hist->counts[php_pinba_histogram_bucket(value)] += hits;
+}
+/* }}} */
+
+static void php_pinba_histogram_merge(pinba_histogram *dst, const pinba_histogram *src) /* {{{ */
+{
+	int i;
+
+	if (src->hits == 0) {
+		return;
+	}
+	if (dst->hits == 0 || src->min < dst->min) {
+		dst->min = src->min;
+	}
+	if (dst->hits == 0 || src->max > dst->max) {
+		dst->max = src->max;
+	}
+	dst->hits += src->hits;
+	for (i = 0; i < PINBA_HISTOGRAM_BUCKETS; i++) {
+		dst->counts[i] += src->counts[i];
+	}
+}
+/* }}} */
+
+/* Find the timer with the same tags in a table keyed by tag fingerprints.
+   Tag sets with colliding fingerprints take the following free keys,
+   *slot is set to the key of the found timer or to the first free one. */
+static pinba_timer_t *php_pinba_timers_uniq_find(HashTable *ht, pinba_timer_tags_t *tags, zend_ulong *slot) /* {{{ */
+{
+	zend_ulong h = tags->hash;
+	pinba_timer_t *t;
+
+	while ((t = zend_hash_index_find_ptr(ht, h)) != NULL) {
+		if (php_pinba_tags_equal(t->tags, tags)) {
+			break;
+		}
+		h++;
+	}
+
+	*slot = h;
+	return t;
+}
+/* }}} */
+
+/* drop the timer from PINBA_G(timers_list) along with the list's reference, which may free it */
+static void php_pinba_timer_unlink(pinba_timer_t *t) /* {{{ */
+{
+	if (!t->linked) {
+		return;
+	}
+
+	PINBA_TIMER_LIST_REMOVE(PINBA_G(timers_list), t, link);
+	t->linked = 0;
+	if (t->weak) {
+		t->weak = 0;
+		return;
+	}
+	OBJ_RELEASE(PINBA_TIMER_ZOBJ(t));
+}
+/* }}} */
+
+/* the timer folded into when PINBA_G(timers_folded) has pinba.max_timers tag sets already */
+static pinba_timer_t *php_pinba_overflow_timer(void) /* {{{ */
+{
+	pinba_timer_tags_t *tags;
+	pinba_timer_t *t;
+	zend_ulong slot;
+	size_t blob_pos = 0, blob_len = sizeof(PINBA_OVERFLOW_TAG) + sizeof("1");
+
+	if (PINBA_G(overflow_timer)) {
+		return PINBA_G(overflow_timer);
+	}
+
+	tags = (pinba_timer_tags_t *)php_pinba_timers_alloc(PINBA_TAGS_SIZE(1, blob_len));
+	tags->num = 1;
+	tags->blob_len = blob_len;
+	tags->dict_gen = 0;
+	php_pinba_tags_set(tags, 0, &blob_pos, PINBA_OVERFLOW_TAG, sizeof(PINBA_OVERFLOW_TAG) - 1, "1", 1);
+	php_pinba_tags_hash(tags);
+
+	t = php_pinba_timers_uniq_find(&PINBA_G(timers_folded), tags, &slot);
+	if (t) {
+		php_pinba_timers_free(tags);
+	} else {
+		t = php_pinba_timers_calloc(sizeof(pinba_timer_t));
+		t->packet_index = -1;
+		t->tags = tags;
+		zend_hash_index_add_ptr(&PINBA_G(timers_folded), slot, t);
+	}
+	PINBA_G(overflow_timer) = t;
+	return t;
+}
+/* }}} */
+
+/* the timer with these tags in PINBA_G(timers_folded), a new one with a copy of the tags
+   or, if capped, the overflow timer when there are pinba.max_timers tag sets already */
+static pinba_timer_t *php_pinba_timers_folded_find(pinba_timer_tags_t *tags, zend_bool capped) /* {{{ */
+{
+	pinba_timer_t *folded;
+	zend_ulong slot;
+
+	folded = php_pinba_timers_uniq_find(&PINBA_G(timers_folded), tags, &slot);
+	if (folded) {
+		return folded;
+	}
+	if (capped && PINBA_G(max_timers) > 0 && zend_hash_num_elements(&PINBA_G(timers_folded)) >= (uint32_t)PINBA_G(max_timers)) {
+		return php_pinba_overflow_timer();
+	}
+	folded = php_pinba_timers_calloc(sizeof(pinba_timer_t));
+	folded->packet_index = -1;
+	folded->tags = (pinba_timer_tags_t *)php_pinba_timers_alloc(PINBA_TAGS_SIZE(tags->num, tags->blob_len));
+	memcpy(folded->tags, tags, PINBA_TAGS_SIZE(tags->num, tags->blob_len));
+	zend_hash_index_add_ptr(&PINBA_G(timers_folded), slot, folded);
+	return folded;
+}
+/* }}} */
+
+/* Add a stopped timer the script has dropped to the timer with the same tags in PINBA_G(timers_folded),
+   so that a loop creating timers with the same tags keeps one timer per tag set until the flush.
+   Callers that already know the folded timer pass it, it is returned either way. */
+static pinba_timer_t *php_pinba_timer_fold(pinba_timer_t *t, pinba_timer_t *folded) /* {{{ */
+{
+	unsigned int hits = t->hit_count ? t->hit_count : 1;
+
+	if (!folded) {
+		folded = php_pinba_timers_folded_find(t->tags, 1);
+	}
+
+	folded->hit_count += hits;
+	folded->value += t->value;
+	folded->children_value += t->children_value;
+	folded->ru_utime += t->ru_utime;
+	folded->ru_stime += t->ru_stime;
+	folded->cpu |= t->cpu;
+
+	/* keep the distribution of the folded timers, not just their sum */
+	if (PINBA_G(timer_histograms)) {
+		if (!folded->hist) {
+			folded->hist = php_pinba_timers_calloc(sizeof(pinba_histogram));
+		}
+		if (t->hist) {
+			php_pinba_histogram_merge(folded->hist, t->hist);
+		} else {
+			php_pinba_histogram_add(folded->hist, t->value / hits, hits);
+		}
+	}
+	if (PINBA_G(sketches)) {
+		if (!folded->sketch) {
+			folded->sketch = emalloc(sizeof(pinba_sketch));
+			pinba_sketch_init(folded->sketch, PINBA_SKETCH_DEFAULT_ALPHA);
+		}
+		if (t->sketch) {
+			pinba_sketch_merge(folded->sketch, t->sketch);
+		} else {
+			pinba_sketch_add(folded->sketch, ns_to_float(t->value) / hits, hits);
+		}
+	}
+	return folded;
+}
+/* }}} */
+
+/* A stopped timer doesn't need the list's reference: when the script drops it, it is folded instead of
+   being kept until the flush. Nested timers stay as they are, their parent is needed for the packet. */
+static void php_pinba_timer_weaken(pinba_timer_t *t) /* {{{ */
+{
+	if (!t->linked || t->weak || t->started || t->deleted || t->parent) {
+		return;
+	}
+
+	t->weak = 1;
+	OBJ_RELEASE(PINBA_TIMER_ZOBJ(t));
+}
+/* }}} */
+
+static void php_pinba_timers_folded_clean(void) /* {{{ */
+{
+	zend_hash_clean(&PINBA_G(timers_folded));
+	PINBA_G(overflow_timer) = NULL;
+}
+/* }}} */
+
+/* automatic timers only record between RINIT and RSHUTDOWN, and not after the data is sent */
+static inline zend_bool php_pinba_auto_active(void) /* {{{ */
+{
+	return !PINBA_G(in_rshutdown) && !PINBA_G(timers_stopped);
+}
+/* }}} */
+
+/* add a finished call to PINBA_G(timers_folded) the same way a dropped timer is folded */
+static pinba_timer_t *php_pinba_auto_record(pinba_timer_tags_t *tags, int64_t value, pinba_timer_t *folded) /* {{{ */
+{
+	pinba_timer_t tmp;
+
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.tags = tags;
+	tmp.value = value;
+	tmp.hit_count = 1;
+	return php_pinba_timer_fold(&tmp, folded);
+}
+/* }}} */
+
+/* counters are timers with no time, the count is sent in timer_counter and every call is a hit;
+   there are a few fixed counters, so they don't take the place of timers under pinba.max_timers */
+static void php_pinba_auto_count(pinba_timer_tags_t *tags, size_t count) /* {{{ */
+{
+	pinba_timer_t *t = php_pinba_timers_folded_find(tags, 0);
+
+	t->counter = 1;
+	t->count += count;
+	t->hit_count++;
+}
+/* }}} */
+
+/* a persistent tag set of num name and value pairs sorted by name, shared by all requests and never encoded */
+static pinba_timer_tags_t *php_pinba_tags_const(int num, ...) /* {{{ */
+{
+	pinba_timer_tags_t *tags;
+	size_t blob_len = 0, blob_pos = 0;
+	const char *name, *value;
+	va_list args;
+	int i;
+
+	va_start(args, num);
+	for (i = 0; i < num * 2; i++) {
+		blob_len += strlen(va_arg(args, const char *)) + 1;
+	}
+	va_end(args);
+
+	tags = (pinba_timer_tags_t *)pemalloc(PINBA_TAGS_SIZE(num, blob_len), 1);
+	tags->num = num;
+	tags->blob_len = blob_len;
+	tags->dict_gen = 0;
+	va_start(args, num);
+	for (i = 0; i < num; i++) {
+		name = va_arg(args, const char *);
+		value = va_arg(args, const char *);
+		php_pinba_tags_set(tags, i, &blob_pos, name, strlen(name), value, strlen(value));
+	}
+	va_end(args);
+	php_pinba_tags_hash(tags);
+	return tags;
+}
+/* }}} */
+
+#ifdef PINBA_HAVE_OBSERVER
+/* {{{ automatic timers, see pinba.auto_timers */
+
+#define PINBA_DB_CONNECT 0
+#define PINBA_DB_QUERY 1
+#define PINBA_DB_EXEC 2
+#define PINBA_DB_PREPARE 3
+#define PINBA_DB_EXECUTE 4
+#define PINBA_DB_OPS 5
+
+static const char *pinba_db_op_names[] = { "connect", "query", "exec", "prepare", "execute" };
+
+/* a connection and the statements created from it, by object handle in PINBA_G(db_links) */
+typedef struct _pinba_db_link { /* {{{ */
+	uint32_t refcount;
+	zend_string *host; /* NULL if unknown */
+	pinba_timer_tags_t *tags[PINBA_DB_OPS]; /* built on first use */
+} pinba_db_link;
+/* }}} */
+
+static void php_pinba_db_link_release(pinba_db_link *link) /* {{{ */
+{
+	int i;
+
+	if (--link->refcount > 0) {
+		return;
+	}
+	if (link->host) {
+		zend_string_release(link->host);
+	}
+	for (i = 0; i < PINBA_DB_OPS; i++) {
+		if (link->tags[i]) {
+			efree(link->tags[i]);
+		}
+	}
+	efree(link);
+}
+/* }}} */
+
+static void php_db_link_hash_dtor(zval *zv) /* {{{ */
+{
+	php_pinba_db_link_release(Z_PTR_P(zv));
+}
+/* }}} */
+
+static void php_pinba_db_link_set(zend_object *obj, pinba_db_link *link) /* {{{ */
+{
+	link->refcount++;
+	zend_hash_index_update_ptr(&PINBA_G(db_links), obj->handle, link);
+}
+/* }}} */
+
+/* object handles start at 1, calls on unknown connections share the link at 0 */
+static pinba_db_link *php_pinba_db_link_find(zend_object *obj) /* {{{ */
+{
+	pinba_db_link *link;
+
+	if (obj && (link = zend_hash_index_find_ptr(&PINBA_G(db_links), obj->handle)) != NULL) {
+		return link;
+	}
+	link = zend_hash_index_find_ptr(&PINBA_G(db_links), 0);
+	if (!link) {
+		link = ecalloc(1, sizeof(pinba_db_link));
+		link->refcount = 1;
+		zend_hash_index_add_ptr(&PINBA_G(db_links), 0, link);
+	}
+	return link;
+}
+/* }}} */
+
+/* host of a PDO DSN ("mysql:host=db1;dbname=test") or a mysqli host ("p:db1"), NULL if there is none */
+static zend_string *php_pinba_db_host(const char *str, size_t len, zend_bool dsn) /* {{{ */
+{
+	const char *p, *end = str + len, *host = NULL;
+	size_t host_len = 0;
+	zend_string *result;
+
+	if (dsn) {
+		/* look for the host= or unix_socket= parameter after the driver name */
+		p = memchr(str, ':', len);
+		for (p = p ? p + 1 : end; p < end; p++) {
+			const char *param = p;
+
+			p = memchr(param, ';', end - param);
+			if (!p) {
+				p = end;
+			}
+			if (p - param > 5 && strncasecmp(param, "host=", 5) == 0) {
+				host = param + 5;
+				host_len = p - host;
+				break;
+			}
+			if (p - param > 12 && strncasecmp(param, "unix_socket=", 12) == 0) {
+				host = "localhost";
+				host_len = sizeof("localhost") - 1;
+				break;
+			}
+		}
+	} else {
+		host = str;
+		host_len = len;
+		if (host_len > 2 && (host[0] == 'p' || host[0] == 'P') && host[1] == ':') {
+			host += 2;
+			host_len -= 2;
+		}
+	}
+
+	if (!host || !host_len) {
+		return NULL;
+	}
+	result = zend_string_alloc(host_len, 0);
+	zend_str_tolower_copy(ZSTR_VAL(result), host, host_len);
+	return result;
+}
+/* }}} */
+
+static pinba_timer_tags_t *php_pinba_db_tags(pinba_db_link *link, int op) /* {{{ */
+{
+	pinba_timer_tags_t *tags;
+	size_t blob_pos = 0, blob_len;
+	const char *op_name = pinba_db_op_names[op];
+	int i = 0;
+
+	if (link->tags[op]) {
+		return link->tags[op];
+	}
+
+	/* sorted by name: dsn_host, group, op */
+	blob_len = sizeof("group") + sizeof("db") + sizeof("op") + strlen(op_name) + 1;
+	if (link->host) {
+		blob_len += sizeof("dsn_host") + ZSTR_LEN(link->host) + 1;
+	}
+	tags = (pinba_timer_tags_t *)emalloc(PINBA_TAGS_SIZE(link->host ? 3 : 2, blob_len));
+	tags->num = link->host ? 3 : 2;
+	tags->blob_len = blob_len;
+	tags->dict_gen = 0;
+	if (link->host) {
+		php_pinba_tags_set(tags, i++, &blob_pos, "dsn_host", sizeof("dsn_host") - 1, ZSTR_VAL(link->host), ZSTR_LEN(link->host));
+	}
+	php_pinba_tags_set(tags, i++, &blob_pos, "group", sizeof("group") - 1, "db", sizeof("db") - 1);
+	php_pinba_tags_set(tags, i++, &blob_pos, "op", sizeof("op") - 1, op_name, strlen(op_name));
+	php_pinba_tags_hash(tags);
+
+	link->tags[op] = tags;
+	return tags;
+}
+/* }}} */
+
+static void php_pinba_observer_begin(zend_execute_data *execute_data) /* {{{ */
+{
+	if (PINBA_G(observe_depth) < PINBA_OBSERVE_DEPTH) {
+		PINBA_G(observe_start)[PINBA_G(observe_depth)] = php_pinba_clock_ns();
+	}
+	PINBA_G(observe_depth)++;
+}
+/* }}} */
+
+/* returns the start time of the call, 0 if it is not known */
+static inline int64_t php_pinba_observer_pop(void) /* {{{ */
+{
+	if (PINBA_G(observe_depth) == 0) {
+		return 0;
+	}
+	if (--PINBA_G(observe_depth) >= PINBA_OBSERVE_DEPTH || !php_pinba_auto_active()) {
+		return 0;
+	}
+	return PINBA_G(observe_start)[PINBA_G(observe_depth)];
+}
+/* }}} */
+
+static void php_pinba_db_end(zend_execute_data *execute_data, zval *retval, int op) /* {{{ */
+{
+	int64_t start = php_pinba_observer_pop(), now;
+	zend_class_entry *scope = execute_data->func->common.scope;
+	zend_object *obj = NULL;
+	pinba_db_link *link;
+	uint32_t i, num_args;
+
+	if (!start) {
+		return;
+	}
+	now = php_pinba_clock_ns();
+	num_args = ZEND_CALL_NUM_ARGS(execute_data);
+
+	/* the connection is $this, the first argument of mysqli functions or what mysqli_connect() returns */
+	if (Z_TYPE(execute_data->This) == IS_OBJECT) {
+		obj = Z_OBJ(execute_data->This);
+	} else if (num_args > 0 && Z_TYPE_P(ZEND_CALL_ARG(execute_data, 1)) == IS_OBJECT) {
+		obj = Z_OBJ_P(ZEND_CALL_ARG(execute_data, 1));
+	} else if (op == PINBA_DB_CONNECT && retval && Z_TYPE_P(retval) == IS_OBJECT) {
+		obj = Z_OBJ_P(retval);
+	}
+
+	if (op == PINBA_DB_CONNECT) {
+		link = ecalloc(1, sizeof(pinba_db_link));
+		/* the DSN or the host is the first string argument */
+		for (i = 1; i <= num_args && i <= 2; i++) {
+			zval *arg = ZEND_CALL_ARG(execute_data, i);
+
+			if (Z_TYPE_P(arg) == IS_STRING) {
+				link->host = php_pinba_db_host(Z_STRVAL_P(arg), Z_STRLEN_P(arg), scope && zend_string_equals_literal_ci(scope->name, "PDO"));
+				break;
+			}
+		}
+		if (obj) {
+			php_pinba_db_link_set(obj, link);
+		} else {
+			/* failed procedural connect */
+			link->refcount = 1;
+			php_pinba_auto_record(php_pinba_db_tags(link, op), now - start, NULL);
+			php_pinba_db_link_release(link);
+			return;
+		}
+	} else {
+		link = php_pinba_db_link_find(obj);
+		/* statements and results report the host of their connection */
+		if ((op == PINBA_DB_PREPARE || op == PINBA_DB_QUERY) && retval && Z_TYPE_P(retval) == IS_OBJECT) {
+			php_pinba_db_link_set(Z_OBJ_P(retval), link);
+		}
+	}
+
+	php_pinba_auto_record(php_pinba_db_tags(link, op), now - start, NULL);
+}
+/* }}} */
+
+#define PINBA_DB_END_HANDLER(name, op) \
+	static void php_pinba_db_end_ ## name(zend_execute_data *execute_data, zval *retval) \
+	{ \
+		php_pinba_db_end(execute_data, retval, op); \
+	}
+
+PINBA_DB_END_HANDLER(connect, PINBA_DB_CONNECT)
+PINBA_DB_END_HANDLER(query, PINBA_DB_QUERY)
+PINBA_DB_END_HANDLER(exec, PINBA_DB_EXEC)
+PINBA_DB_END_HANDLER(prepare, PINBA_DB_PREPARE)
+PINBA_DB_END_HANDLER(execute, PINBA_DB_EXECUTE)
+
+/* host[:port] of a URL, lowercase and without the default port of its scheme, NULL if there is none */
+static zend_string *php_pinba_url_host(const char *str, size_t len) /* {{{ */
+{
+	const char *p, *end = str + len, *scheme = str, *host, *port = NULL;
+	size_t scheme_len = 0, host_len;
+	zend_string *result;
+
+	p = zend_memnstr(str, "://", 3, end);
+	if (p) {
+		scheme_len = p - str;
+		str = p + 3;
+	}
+	for (p = str; p < end && *p != '/' && *p != '?' && *p != '#'; p++);
+	end = p;
+
+	/* user:password@ */
+	for (host = p = str; p < end; p++) {
+		if (*p == '@') {
+			host = p + 1;
+		}
+	}
+	if (host < end && *host == '[') {
+		p = memchr(host, ']', end - host);
+		p = p ? p + 1 : end;
+	} else {
+		p = memchr(host, ':', end - host);
+		if (!p) {
+			p = end;
+		}
+	}
+	if (p < end && *p == ':') {
+		port = p + 1;
+	}
+	host_len = p - host;
+	if (host_len && host[host_len - 1] == '.') {
+		host_len--;
+	}
+	if (!host_len) {
+		return NULL;
+	}
+
+	if (port && ((scheme_len == 4 && strncasecmp(scheme, "http", 4) == 0 && end - port == 2 && memcmp(port, "80", 2) == 0)
+				|| (scheme_len == 5 && strncasecmp(scheme, "https", 5) == 0 && end - port == 3 && memcmp(port, "443", 3) == 0))) {
+		port = NULL;
+	}
+
+	result = zend_string_alloc(host_len + (port ? end - port + 1 : 0), 0);
+	zend_str_tolower_copy(ZSTR_VAL(result), host, host_len);
+	if (port) {
+		ZSTR_VAL(result)[host_len] = ':';
+		memcpy(ZSTR_VAL(result) + host_len + 1, port, end - port);
+		ZSTR_VAL(result)[ZSTR_LEN(result)] = '\0';
+	}
+	return result;
+}
+/* }}} */
+
+/* time spent in a curl transfer, tagged with the host of its effective URL and the response code */
+static void php_pinba_curl_record(zval *handle, int64_t value) /* {{{ */
+{
+	static zend_function *curl_getinfo = NULL;
+	pinba_timer_tags_t *tags;
+	zend_string *host = NULL;
+	zval info, *url, *code;
+	char status[MAX_LENGTH_OF_LONG + 1], *status_str;
+	size_t blob_pos = 0, blob_len, status_len;
+	int i = 0;
+
+	/* internal functions do not move, curl_getinfo() is called directly and is not observed */
+	if (!curl_getinfo && (curl_getinfo = zend_hash_str_find_ptr(EG(function_table), "curl_getinfo", sizeof("curl_getinfo") - 1)) == NULL) {
+		return;
+	}
+	ZVAL_UNDEF(&info);
+	zend_call_known_function(curl_getinfo, NULL, NULL, &info, 1, handle, NULL);
+	if (EG(exception) || Z_TYPE(info) != IS_ARRAY) {
+		zval_ptr_dtor(&info);
+		return;
+	}
+
+	url = zend_hash_str_find(Z_ARRVAL(info), "url", sizeof("url") - 1);
+	if (url && Z_TYPE_P(url) == IS_STRING) {
+		host = php_pinba_url_host(Z_STRVAL_P(url), Z_STRLEN_P(url));
+	}
+	code = zend_hash_str_find(Z_ARRVAL(info), "http_code", sizeof("http_code") - 1);
+	status_str = zend_print_long_to_buf(status + sizeof(status) - 1, code ? zval_get_long(code) : 0);
+	status_len = status + sizeof(status) - 1 - status_str;
+	zval_ptr_dtor(&info);
+
+	/* sorted by name: group, host, status */
+	blob_len = sizeof("group") + sizeof("curl") + sizeof("status") + status_len + 1;
+	if (host) {
+		blob_len += sizeof("host") + ZSTR_LEN(host) + 1;
+	}
+	tags = (pinba_timer_tags_t *)emalloc(PINBA_TAGS_SIZE(host ? 3 : 2, blob_len));
+	tags->num = host ? 3 : 2;
+	tags->blob_len = blob_len;
+	tags->dict_gen = 0;
+	php_pinba_tags_set(tags, i++, &blob_pos, "group", sizeof("group") - 1, "curl", sizeof("curl") - 1);
+	if (host) {
+		php_pinba_tags_set(tags, i++, &blob_pos, "host", sizeof("host") - 1, ZSTR_VAL(host), ZSTR_LEN(host));
+		zend_string_release(host);
+	}
+	php_pinba_tags_set(tags, i++, &blob_pos, "status", sizeof("status") - 1, status_str, status_len);
+	php_pinba_tags_hash(tags);
+
+	/* the folded timer keeps a copy */
+	php_pinba_auto_record(tags, value, NULL);
+	efree(tags);
+}
+/* }}} */
+
+static void php_pinba_curl_end_exec(zend_execute_data *execute_data, zval *retval) /* {{{ */
+{
+	int64_t start = php_pinba_observer_pop();
+
+	if (!start || EG(exception) || ZEND_CALL_NUM_ARGS(execute_data) < 1) {
+		return;
+	}
+	php_pinba_curl_record(ZEND_CALL_ARG(execute_data, 1), php_pinba_clock_ns() - start);
+}
+/* }}} */
+
+/* a transfer of a multi handle is timed from curl_multi_add_handle() to curl_multi_remove_handle() */
+static void php_pinba_curl_end_add_handle(zend_execute_data *execute_data, zval *retval) /* {{{ */
+{
+	zval *handle, start;
+
+	if (!php_pinba_observer_pop() || ZEND_CALL_NUM_ARGS(execute_data) < 2 || !retval || Z_TYPE_P(retval) != IS_LONG || Z_LVAL_P(retval) != 0) {
+		return;
+	}
+	handle = ZEND_CALL_ARG(execute_data, 2);
+	if (Z_TYPE_P(handle) == IS_OBJECT) {
+		ZVAL_LONG(&start, php_pinba_clock_ns());
+		zend_hash_index_update(&PINBA_G(curl_handles), Z_OBJ_HANDLE_P(handle), &start);
+	}
+}
+/* }}} */
+
+static void php_pinba_curl_end_remove_handle(zend_execute_data *execute_data, zval *retval) /* {{{ */
+{
+	zval *handle, *start;
+
+	if (!php_pinba_observer_pop() || EG(exception) || ZEND_CALL_NUM_ARGS(execute_data) < 2) {
+		return;
+	}
+	handle = ZEND_CALL_ARG(execute_data, 2);
+	if (Z_TYPE_P(handle) != IS_OBJECT || (start = zend_hash_index_find(&PINBA_G(curl_handles), Z_OBJ_HANDLE_P(handle))) == NULL) {
+		return;
+	}
+	php_pinba_curl_record(handle, php_pinba_clock_ns() - Z_LVAL_P(start));
+	zend_hash_index_del(&PINBA_G(curl_handles), Z_OBJ_HANDLE_P(handle));
+}
+/* }}} */
+
+#define PINBA_CURL_MULTI_BLOB_LEN (sizeof("group") + sizeof("curl") + sizeof("op") + sizeof("multi"))
+
+/* time the script spends driving multi handles, the transfers overlap so it is not their sum */
+static void php_pinba_curl_end_multi(zend_execute_data *execute_data, zval *retval) /* {{{ */
+{
+	union {
+		pinba_timer_tags_t tags;
+		char buf[PINBA_TAGS_SIZE(2, PINBA_CURL_MULTI_BLOB_LEN)];
+	} multi;
+	int64_t start = php_pinba_observer_pop();
+	size_t blob_pos = 0;
+
+	if (!start) {
+		return;
+	}
+	multi.tags.num = 2;
+	multi.tags.blob_len = PINBA_CURL_MULTI_BLOB_LEN;
+	multi.tags.dict_gen = 0;
+	php_pinba_tags_set(&multi.tags, 0, &blob_pos, "group", sizeof("group") - 1, "curl", sizeof("curl") - 1);
+	php_pinba_tags_set(&multi.tags, 1, &blob_pos, "op", sizeof("op") - 1, "multi", sizeof("multi") - 1);
+	php_pinba_tags_hash(&multi.tags);
+	php_pinba_auto_record(&multi.tags, php_pinba_clock_ns() - start, NULL);
+}
+/* }}} */
+
+typedef struct _pinba_auto_function { /* {{{ */
+	int flag; /* PINBA_AUTO_* source the function belongs to */
+	const char *class_name; /* NULL for functions */
+	const char *name;
+	zend_observer_fcall_end_handler end;
+} pinba_auto_function;
+/* }}} */
+
+static const pinba_auto_function pinba_auto_functions[] = {
+	{ PINBA_AUTO_PDO, "PDO", "__construct", php_pinba_db_end_connect },
+	{ PINBA_AUTO_PDO, "PDO", "query", php_pinba_db_end_query },
+	{ PINBA_AUTO_PDO, "PDO", "exec", php_pinba_db_end_exec },
+	{ PINBA_AUTO_PDO, "PDO", "prepare", php_pinba_db_end_prepare },
+	{ PINBA_AUTO_PDO, "PDOStatement", "execute", php_pinba_db_end_execute },
+	{ PINBA_AUTO_MYSQLI, "mysqli", "__construct", php_pinba_db_end_connect },
+	{ PINBA_AUTO_MYSQLI, "mysqli", "connect", php_pinba_db_end_connect },
+	{ PINBA_AUTO_MYSQLI, "mysqli", "real_connect", php_pinba_db_end_connect },
+	{ PINBA_AUTO_MYSQLI, "mysqli", "query", php_pinba_db_end_query },
+	{ PINBA_AUTO_MYSQLI, "mysqli", "real_query", php_pinba_db_end_query },
+	{ PINBA_AUTO_MYSQLI, "mysqli", "multi_query", php_pinba_db_end_query },
+	{ PINBA_AUTO_MYSQLI, "mysqli", "execute_query", php_pinba_db_end_query },
+	{ PINBA_AUTO_MYSQLI, "mysqli", "prepare", php_pinba_db_end_prepare },
+	{ PINBA_AUTO_MYSQLI, "mysqli_stmt", "execute", php_pinba_db_end_execute },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_connect", php_pinba_db_end_connect },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_real_connect", php_pinba_db_end_connect },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_query", php_pinba_db_end_query },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_real_query", php_pinba_db_end_query },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_multi_query", php_pinba_db_end_query },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_execute_query", php_pinba_db_end_query },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_prepare", php_pinba_db_end_prepare },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_stmt_execute", php_pinba_db_end_execute },
+	{ PINBA_AUTO_MYSQLI, NULL, "mysqli_execute", php_pinba_db_end_execute },
+	{ PINBA_AUTO_CURL, NULL, "curl_exec", php_pinba_curl_end_exec },
+	{ PINBA_AUTO_CURL, NULL, "curl_multi_add_handle", php_pinba_curl_end_add_handle },
+	{ PINBA_AUTO_CURL, NULL, "curl_multi_remove_handle", php_pinba_curl_end_remove_handle },
+	{ PINBA_AUTO_CURL, NULL, "curl_multi_exec", php_pinba_curl_end_multi },
+	{ PINBA_AUTO_CURL, NULL, "curl_multi_select", php_pinba_curl_end_multi },
+};
+
+#define PINBA_AUTO_FUNCTIONS_NUM (sizeof(pinba_auto_functions) / sizeof(pinba_auto_functions[0]))
+
+/* a function matching pinba.observe_functions, by function pointer in PINBA_G(observed_functions) */
+typedef struct _pinba_observed_function { /* {{{ */
+	pinba_timer_tags_t *tags; /* group => function, function => Class::method */
+	pinba_timer_t *folded; /* where the calls went last time, valid while dict_gen is PINBA_G(dict_gen) */
+	uint32_t dict_gen;
+} pinba_observed_function;
+/* }}} */
+
+static void php_observed_function_hash_dtor(zval *zv) /* {{{ */
+{
+	pinba_observed_function *of = Z_PTR_P(zv);
+
+	efree(of->tags);
+	efree(of);
+}
+/* }}} */
+
+static pinba_observed_function *php_pinba_observed_function(zend_function *func) /* {{{ */
+{
+	pinba_observed_function *of;
+	pinba_timer_tags_t *tags;
+	zend_string *value;
+	size_t blob_len, blob_pos = 0;
+
+	of = zend_hash_index_find_ptr(&PINBA_G(observed_functions), (zend_ulong)(uintptr_t)func);
+	if (of) {
+		return of;
+	}
+
+	if (func->common.scope) {
+		value = zend_create_member_string(func->common.scope->name, func->common.function_name);
+	} else {
+		value = zend_string_copy(func->common.function_name);
+	}
+
+	/* sorted by name: function, group */
+	blob_len = sizeof("function") + ZSTR_LEN(value) + 1 + sizeof("group") + sizeof("function");
+	tags = (pinba_timer_tags_t *)emalloc(PINBA_TAGS_SIZE(2, blob_len));
+	tags->num = 2;
+	tags->blob_len = blob_len;
+	tags->dict_gen = 0;
+	php_pinba_tags_set(tags, 0, &blob_pos, "function", sizeof("function") - 1, ZSTR_VAL(value), ZSTR_LEN(value));
+	php_pinba_tags_set(tags, 1, &blob_pos, "group", sizeof("group") - 1, "function", sizeof("function") - 1);
+	php_pinba_tags_hash(tags);
+	zend_string_release(value);
+
+	of = emalloc(sizeof(pinba_observed_function));
+	of->tags = tags;
+	of->folded = NULL;
+	of->dict_gen = 0;
+	zend_hash_index_add_ptr(&PINBA_G(observed_functions), (zend_ulong)(uintptr_t)func, of);
+	return of;
+}
+/* }}} */
+
+static void php_pinba_function_end(zend_execute_data *execute_data, zval *retval) /* {{{ */
+{
+	int64_t start = php_pinba_observer_pop();
+	pinba_observed_function *of;
+
+	if (!start) {
+		return;
+	}
+
+	/* no tags to build, and no lookup of the folded timer until the next flush */
+	of = php_pinba_observed_function(execute_data->func);
+	of->folded = php_pinba_auto_record(of->tags, php_pinba_clock_ns() - start, of->dict_gen == PINBA_G(dict_gen) ? of->folded : NULL);
+	of->dict_gen = PINBA_G(dict_gen);
 }
 /* }}} */
 
-static inline void php_pinba_cleanup_collectors(pinba_collector *collectors, unsigned int *n_collectors) /* {{{ */
+static zend_bool php_pinba_observe_function_matches(zend_function *func) /* {{{ */
 {
+	zend_string *name = func->common.function_name;
+	zend_class_entry *scope = func->common.scope;
 	int i;
 
-	for (i = 0; i < *n_collectors; i++) {
-		pinba_collector *collector = &collectors[i];
+	for (i = 0; i < pinba_observe_patterns_num; i++) {
+		const pinba_observe_pattern *pattern = &pinba_observe_patterns[i];
 
-		if (collector->host) {
-			free(collector->host);
+		if ((pattern->class_name == NULL) != (scope == NULL)) {
+			continue;
 		}
-
-		if (collector->port) {
-			free(collector->port);
+		if (scope && zend_binary_strcasecmp(ZSTR_VAL(scope->name), ZSTR_LEN(scope->name), pattern->class_name, pattern->class_len) != 0) {
+			continue;
+		}
+		if (pattern->name && zend_binary_strcasecmp(ZSTR_VAL(name), ZSTR_LEN(name), pattern->name, pattern->name_len) != 0) {
+			continue;
 		}
+		return 1;
 	}
-	*n_collectors = 0;
+	return 0;
 }
 /* }}} */
 
-static inline int php_pinba_parse_server(char *address, char **host, char **port) /* {{{ */
+/* Called once per function and request before its first call. Functions we don't time get no handlers,
+   so the engine doesn't call us for them at all. */
+static zend_observer_fcall_handlers php_pinba_observer_init(zend_execute_data *execute_data) /* {{{ */
 {
-	char *new_node, *new_service = NULL;
+	zend_function *func = execute_data->func;
+	zend_observer_fcall_handlers handlers = { NULL, NULL };
+	zend_string *name = func->common.function_name;
+	zend_class_entry *scope = func->common.scope;
+	size_t i;
 
-	*host = *port = NULL;
-
-	if (address[0] == 0) { /* empty string, just skip */
-		return FAILURE;
+	/* trampolines (__call) and closures are allocated per call */
+	if (!name || (func->common.fn_flags & (ZEND_ACC_CALL_VIA_TRAMPOLINE | ZEND_ACC_CLOSURE))) {
+		return handlers;
 	}
 
-	/* '[' <node> ']' [':' <service>] */
-	if (address[0] == '[') {
-		char *endptr;
-
-		new_node = address + 1;
+	if (pinba_observe_patterns_num && php_pinba_observe_function_matches(func)) {
+		php_pinba_observed_function(func);
+		handlers.begin = php_pinba_observer_begin;
+		handlers.end = php_pinba_function_end;
+		return handlers;
+	}
 
-		endptr = strchr(new_node, ']');
-		if (endptr == NULL) {
-			return FAILURE;
-		}
-		*endptr = 0;
-		endptr++;
+	if (func->type != ZEND_INTERNAL_FUNCTION) {
+		return handlers;
+	}
 
-		if (*endptr != ':' && *endptr != 0) {
-			return FAILURE;
-		}
+	for (i = 0; i < PINBA_AUTO_FUNCTIONS_NUM; i++) {
+		const pinba_auto_function *f = &pinba_auto_functions[i];
 
-		if (*endptr != 0) {
-			new_service = endptr + 1;
+		if (!(pinba_auto_timers & f->flag) || (f->class_name == NULL) != (scope == NULL)) {
+			continue;
 		}
-
-		if (new_service != NULL && *new_service == 0) {
-			new_service = NULL;
+		if (zend_binary_strcasecmp(ZSTR_VAL(name), ZSTR_LEN(name), f->name, strlen(f->name)) != 0) {
+			continue;
 		}
-	}
-	/* <ipv4 node> [':' <service>] */
-	else if ((strchr(address, ':') == NULL) /* no colon */
-			|| (strchr(address, ':') == strrchr(address, ':'))) { /* exactly one colon */
-		char *endptr = strchr(address, ':');
-
-		if (endptr != NULL) {
-			*endptr = 0;
-			new_service = endptr + 1;
+		if (scope && zend_binary_strcasecmp(ZSTR_VAL(scope->name), ZSTR_LEN(scope->name), f->class_name, strlen(f->class_name)) != 0) {
+			continue;
 		}
-		new_node = address;
-	}
-	/* <ipv6 node> */
-	else { /* multiple colons */
-		new_node = address;
+		handlers.begin = php_pinba_observer_begin;
+		handlers.end = f->end;
+		break;
 	}
-	*host = new_node;
-	*port = new_service;
-	return SUCCESS;
+	return handlers;
 }
 /* }}} */
 
-static inline int php_pinba_timer_stop(pinba_timer_t *t, struct timeval *pnow, struct rusage *pu) /* {{{ */
-{
-	struct timeval now;
-	struct rusage u, tmp;
-
-	if (!t->started) {
-		return FAILURE;
-	}
+/* }}} */
+#endif /* PINBA_HAVE_OBSERVER */
+
+/* {{{ compile, autoload and gc timers, see pinba.auto_timers */
+
+static pinba_timer_tags_t *pinba_compile_file_tags; /* group => compile, op => file */
+static pinba_timer_tags_t *pinba_compile_eval_tags; /* group => compile, op => eval */
+static pinba_timer_tags_t *pinba_compile_bytes_tags; /* counter => bytes, group => compile */
+static pinba_timer_tags_t *pinba_autoload_tags; /* group => autoload */
+static pinba_timer_tags_t *pinba_gc_collected_tags; /* counter => collected, group => gc */
+
+static zend_op_array *(*pinba_old_compile_file)(zend_file_handle *file_handle, int type);
+
+#if PHP_VERSION_ID >= 80200
+# define PINBA_COMPILE_STRING_ARGS zend_string *source_string, const char *filename, zend_compile_position position
+# define PINBA_COMPILE_STRING_PASS source_string, filename, position
+# define PINBA_COMPILE_STRING_LEN ZSTR_LEN(source_string)
+#elif PHP_VERSION_ID >= 80000
+# define PINBA_COMPILE_STRING_ARGS zend_string *source_string, const char *filename
+# define PINBA_COMPILE_STRING_PASS source_string, filename
+# define PINBA_COMPILE_STRING_LEN ZSTR_LEN(source_string)
+#else
+# define PINBA_COMPILE_STRING_ARGS zval *source_string, char *filename
+# define PINBA_COMPILE_STRING_PASS source_string, filename
+# define PINBA_COMPILE_STRING_LEN (Z_TYPE_P(source_string) == IS_STRING ? Z_STRLEN_P(source_string) : 0)
+#endif
 
-	if (pnow) {
-		now = *pnow;
-	} else {
-		if (gettimeofday(&now, 0) != 0) {
-			return FAILURE;
-		}
-	}
+static zend_op_array *(*pinba_old_compile_string)(PINBA_COMPILE_STRING_ARGS);
 
-	timersub(&now, &t->start, &t->value);
+/* with opcache in front of it only the files that miss the cache get here */
+static zend_op_array *php_pinba_compile_file(zend_file_handle *file_handle, int type) /* {{{ */
+{
+	zend_op_array *op_array;
+	int64_t start;
+	size_t len;
 
-	if (pu) {
-		u = *pu;
-	} else {
-		if (getrusage(RUSAGE_SELF, &u) != 0) {
-			return FAILURE;
-		}
+	if (!php_pinba_auto_active()) {
+		return pinba_old_compile_file(file_handle, type);
 	}
 
-	timersub(&u.ru_utime, &t->tmp_ru_utime, &tmp.ru_utime);
-	timersub(&u.ru_stime, &t->tmp_ru_stime, &tmp.ru_stime);
-	timeradd(&t->ru_utime, &tmp.ru_utime, &t->ru_utime);
-	timeradd(&t->ru_stime, &tmp.ru_stime, &t->ru_stime);
+	start = php_pinba_clock_ns();
+	op_array = pinba_old_compile_file(file_handle, type);
+	php_pinba_auto_record(pinba_compile_file_tags, php_pinba_clock_ns() - start, NULL);
 
-	t->started = 0;
-	return SUCCESS;
+	/* the file has been read into the handle by now */
+#if PHP_VERSION_ID >= 70400
+	len = file_handle->buf ? file_handle->len : 0;
+#else
+	len = file_handle->type == ZEND_HANDLE_MAPPED ? file_handle->handle.stream.mmap.len : 0;
+#endif
+	if (len) {
+		php_pinba_auto_count(pinba_compile_bytes_tags, len);
+	}
+	return op_array;
 }
 /* }}} */
 
-static inline void php_pinba_timer_tags_dtor(pinba_timer_tag_t **tags, int tags_num) /* {{{ */
+static zend_op_array *php_pinba_compile_string(PINBA_COMPILE_STRING_ARGS) /* {{{ */
 {
-	int i;
-	pinba_timer_tag_t *tag;
+	zend_op_array *op_array;
+	int64_t start;
 
-	for (i = 0; i < tags_num; i++) {
-		tag = *(tags + i);
-		if (tag) {
-			if (tag->name) {
-				efree(tag->name);
-			}
-			if (tag->value) {
-				efree(tag->value);
-			}
-			efree(tag);
-		}
+	if (!php_pinba_auto_active()) {
+		return pinba_old_compile_string(PINBA_COMPILE_STRING_PASS);
 	}
-}
-/* }}} */
 
-static void php_pinba_timer_dtor(pinba_timer_t *t) /* {{{ */
-{
-	php_pinba_timer_tags_dtor(t->tags, t->tags_num);
-	efree(t->tags);
+	start = php_pinba_clock_ns();
+	op_array = pinba_old_compile_string(PINBA_COMPILE_STRING_PASS);
+	php_pinba_auto_record(pinba_compile_eval_tags, php_pinba_clock_ns() - start, NULL);
+	if (PINBA_COMPILE_STRING_LEN) {
+		php_pinba_auto_count(pinba_compile_bytes_tags, PINBA_COMPILE_STRING_LEN);
+	}
+	return op_array;
 }
 /* }}} */
 
-static void php_timer_hash_dtor(zval *zv) /* {{{ */
+#if PHP_VERSION_ID >= 80000
+static zend_class_entry *(*pinba_old_autoload)(zend_string *name, zend_string *lc_name);
+
+/* the whole spl_autoload_call() dispatch, including the files it compiles; nested autoloads are part of the outer one */
+static zend_class_entry *php_pinba_autoload(zend_string *name, zend_string *lc_name) /* {{{ */
 {
-	pinba_timer_t *t = Z_PTR_P(zv);
+	zend_class_entry *ce;
+	int64_t start;
 
-	if (t) {
-		php_pinba_timer_dtor(t);
-		efree(t);
+	if (PINBA_G(autoload_depth) > 0 || !php_pinba_auto_active()) {
+		return pinba_old_autoload(name, lc_name);
 	}
-}
-/* }}} */
-
-static void php_tag_hash_dtor(zval *zv) /* {{{ */
-{
-	char *tag = Z_PTR_P(zv);
 
-	if (tag) {
-		efree(tag);
+	PINBA_G(autoload_depth)++;
+	start = php_pinba_clock_ns();
+	ce = pinba_old_autoload(name, lc_name);
+	PINBA_G(autoload_depth)--;
+	if (php_pinba_auto_active()) {
+		php_pinba_auto_record(pinba_autoload_tags, php_pinba_clock_ns() - start, NULL);
 	}
+	return ce;
 }
 /* }}} */
+#endif
 
-static int php_pinba_tags_to_hashed_string(pinba_timer_tag_t **tags, int tags_num, char **hashed_tags, size_t *hashed_tags_len) /* {{{ */
-{
-	int i;
-	char *buf;
-	size_t buf_len, wrote_len;
+static int (*pinba_old_gc_collect_cycles)(void);
 
-	*hashed_tags = NULL;
-	*hashed_tags_len = 0;
+#define PINBA_GC_BLOB_LEN (sizeof("group") + sizeof("gc") + sizeof("roots") + MAX_LENGTH_OF_LONG + 1)
 
-	if (!tags_num) {
-		return FAILURE;
-	}
+/* every collection, automatic or gc_collect_cycles(), tagged with the size of the roots buffer
+   rounded up to a power of two; what it freed is counted in counter => collected */
+static int php_pinba_gc_collect_cycles(void) /* {{{ */
+{
+	union {
+		pinba_timer_tags_t tags;
+		char buf[PINBA_TAGS_SIZE(2, PINBA_GC_BLOB_LEN)];
+	} gc;
+	char roots[MAX_LENGTH_OF_LONG + 1], *roots_str;
+	size_t blob_pos = 0, roots_len;
+	zend_long bucket = 0;
+	int64_t start;
+	int collected;
+#if PHP_VERSION_ID >= 70300
+	zend_gc_status status;
+#endif
 
-	buf_len = 4096;
-	wrote_len = 0;
-	buf = (char *)emalloc(buf_len + 1);
+	if (!php_pinba_auto_active()) {
+		return pinba_old_gc_collect_cycles();
+	}
 
-	for (i = 0; i < tags_num; i++) {
-		if (buf_len <= (wrote_len + tags[i]->name_len + 2 + tags[i]->value_len + 1)) {
-			buf_len = wrote_len + tags[i]->name_len + 2 + tags[i]->value_len + 1 + 4096;
-			buf = (char *)erealloc(buf, buf_len + 1);
-		}
-		memcpy(buf + wrote_len, tags[i]->name, tags[i]->name_len);
-		wrote_len += tags[i]->name_len;
+#if PHP_VERSION_ID >= 70300
+	zend_gc_get_status(&status);
+	for (bucket = 1; bucket < (zend_long)status.num_roots; bucket <<= 1);
+#endif
 
-		memcpy(buf + wrote_len, "=>", 2);
-		wrote_len += 2;
+	start = php_pinba_clock_ns();
+	collected = pinba_old_gc_collect_cycles();
+	start = php_pinba_clock_ns() - start;
 
-		memcpy(buf + wrote_len, tags[i]->value, tags[i]->value_len);
-		wrote_len += tags[i]->value_len;
+	/* the collection may have run destructors that sent the data */
+	if (!php_pinba_auto_active()) {
+		return collected;
+	}
 
-		memcpy(buf + wrote_len, ",", 1);
-		wrote_len += 1;
+	gc.tags.num = bucket ? 2 : 1;
+	gc.tags.dict_gen = 0;
+	php_pinba_tags_set(&gc.tags, 0, &blob_pos, "group", sizeof("group") - 1, "gc", sizeof("gc") - 1);
+	if (bucket) {
+		roots_str = zend_print_long_to_buf(roots + sizeof(roots) - 1, bucket);
+		roots_len = roots + sizeof(roots) - 1 - roots_str;
+		php_pinba_tags_set(&gc.tags, 1, &blob_pos, "roots", sizeof("roots") - 1, roots_str, roots_len);
+	}
+	gc.tags.blob_len = blob_pos;
+	php_pinba_tags_hash(&gc.tags);
+	php_pinba_auto_record(&gc.tags, start, NULL);
+	if (collected > 0) {
+		php_pinba_auto_count(pinba_gc_collected_tags, collected);
 	}
+	return collected;
+}
+/* }}} */
 
-	buf[wrote_len] = '\0';
+static void php_pinba_engine_hooks_startup(void) /* {{{ */
+{
+	if (pinba_auto_timers & PINBA_AUTO_COMPILE) {
+		pinba_compile_file_tags = php_pinba_tags_const(2, "group", "compile", "op", "file");
+		pinba_compile_eval_tags = php_pinba_tags_const(2, "group", "compile", "op", "eval");
+		pinba_compile_bytes_tags = php_pinba_tags_const(2, "counter", "bytes", "group", "compile");
+		pinba_old_compile_file = zend_compile_file;
+		zend_compile_file = php_pinba_compile_file;
+		pinba_old_compile_string = zend_compile_string;
+		zend_compile_string = php_pinba_compile_string;
+	}
+#if PHP_VERSION_ID >= 80000
+	/* set by SPL, which is started before any shared extension */
+	if ((pinba_auto_timers & PINBA_AUTO_AUTOLOAD) && zend_autoload) {
+		pinba_autoload_tags = php_pinba_tags_const(1, "group", "autoload");
+		pinba_old_autoload = zend_autoload;
+		zend_autoload = php_pinba_autoload;
+	}
+#endif
+	if (pinba_auto_timers & PINBA_AUTO_GC) {
+		pinba_gc_collected_tags = php_pinba_tags_const(2, "counter", "collected", "group", "gc");
+		pinba_old_gc_collect_cycles = gc_collect_cycles;
+		gc_collect_cycles = php_pinba_gc_collect_cycles;
+	}
+}
+/* }}} */
 
-	*hashed_tags = buf;
-	*hashed_tags_len = wrote_len;
-	return SUCCESS;
+static void php_pinba_engine_hooks_shutdown(void) /* {{{ */
+{
+	if (pinba_compile_file_tags) {
+		zend_compile_file = pinba_old_compile_file;
+		zend_compile_string = pinba_old_compile_string;
+		pefree(pinba_compile_file_tags, 1);
+		pefree(pinba_compile_eval_tags, 1);
+		pefree(pinba_compile_bytes_tags, 1);
+		pinba_compile_file_tags = pinba_compile_eval_tags = pinba_compile_bytes_tags = NULL;
+	}
+#if PHP_VERSION_ID >= 80000
+	if (pinba_autoload_tags) {
+		zend_autoload = pinba_old_autoload;
+		pefree(pinba_autoload_tags, 1);
+		pinba_autoload_tags = NULL;
+	}
+#endif
+	if (pinba_gc_collected_tags) {
+		gc_collect_cycles = pinba_old_gc_collect_cycles;
+		pefree(pinba_gc_collected_tags, 1);
+		pinba_gc_collected_tags = NULL;
+	}
 }
 /* }}} */
 
-static void php_timer_resource_dtor(zend_resource *entry) /* {{{ */
+/* }}} */
+
+static void php_pinba_timers_collect(long flags, const int64_t *now, const pinba_cpu_sample *cpu) /* {{{ */
 {
-	pinba_timer_t *t = (pinba_timer_t *)entry->ptr;
+	pinba_timer_t *t;
 
-	php_pinba_timer_stop(t, NULL, NULL);
-	/* php_pinba_timer_dtor(t); all timers are destroyed at once */
+	/* stop the timers and put them into PINBA_G(timers) for sending */
+	for (t = PINBA_G(timers_list).first; t; t = t->link.next) {
+		if (t->deleted || ((flags & PINBA_FLUSH_ONLY_STOPPED_TIMERS) != 0 && t->started)) {
+			continue;
+		}
 
-	/* but we don't need the user data anymore */
-	if (!Z_ISUNDEF(t->data)) {
-		zval_ptr_dtor(&t->data);
-	}
+		php_pinba_timer_stop(t, now, cpu);
+		t->deleted = 1; /* ignore next time */
 
-	if (!t->deleted && !PINBA_G(in_rshutdown)) {
-		/* do nothing */
-	} else {
-		php_pinba_timer_dtor(t);
-		efree(t);
+		if (zend_hash_index_exists(&PINBA_G(timers), PINBA_TIMER_ZOBJ(t)->handle) == 0) {
+			zend_hash_index_update_ptr(&PINBA_G(timers), PINBA_TIMER_ZOBJ(t)->handle, t);
+		}
 	}
 }
 /* }}} */
 
-static int php_pinba_timer_stop_helper(zval *zv, int num_args, va_list args, zend_hash_key *hash_key) /* {{{ */
+/* put the timers into PINBA_G(timers) for pinba_get_data() without stopping them, or take them out again */
+static void php_pinba_timers_snapshot(long flags, zend_bool add) /* {{{ */
 {
-	if (Z_RES_TYPE_P(zv) == le_pinba_timer) {
-		long flags = va_arg(args, long);
-		struct timeval *now = va_arg(args, struct timeval *);
-		struct rusage *u = va_arg(args, struct rusage *);
-
-		pinba_timer_t *t = (pinba_timer_t *)Z_RES_VAL_P(zv);
+	pinba_timer_t *t;
 
+	for (t = PINBA_G(timers_list).first; t; t = t->link.next) {
 		if (t->deleted || ((flags & PINBA_FLUSH_ONLY_STOPPED_TIMERS) != 0 && t->started)) {
-			return ZEND_HASH_APPLY_KEEP;
-		} else {
-			php_pinba_timer_stop(t, now, u);
-			t->deleted = 1; /* ignore next time */
+			continue;
 		}
 
-		if (zend_hash_index_exists(&PINBA_G(timers), t->rsrc_id) == 0) {
-			zend_hash_index_update_ptr(&PINBA_G(timers), t->rsrc_id, t);
+		if (add) {
+			zend_hash_index_add_ptr(&PINBA_G(timers), PINBA_TIMER_ZOBJ(t)->handle, t);
+		} else {
+			zend_hash_index_del(&PINBA_G(timers), PINBA_TIMER_ZOBJ(t)->handle);
 		}
-		return ZEND_HASH_APPLY_KEEP;
-
 	}
-	return ZEND_HASH_APPLY_KEEP;
 }
 /* }}} */
 
-static int php_pinba_timer_delete_helper(zval *zv) /* {{{ */
+static void php_pinba_timers_delete(void) /* {{{ */
 {
-	if (Z_RES_TYPE_P(zv) == le_pinba_timer) {
-		pinba_timer_t *t = (pinba_timer_t *)Z_RES_VAL_P(zv);
+	pinba_timer_t *t, *next;
+
+	php_pinba_timers_folded_clean();
+	php_pinba_dict_reset();
 
+	for (t = PINBA_G(timers_list).first; t; t = next) {
+		next = t->link.next;
+
+		/* timers still referenced by the script stay alive, but they won't be sent again */
 		if (t->deleted) {
-			/* only delete from the list if there are no references to this zval */
-			if (GC_REFCOUNT(Z_COUNTED_P(zv)) == 1) {
-				return ZEND_HASH_APPLY_REMOVE;
-			}
+			php_pinba_timer_unlink(t);
 		}
 	}
-	return ZEND_HASH_APPLY_KEEP;
 }
 /* }}} */
 
@@ -551,23 +2181,6 @@ static int php_pinba_init_socket(pinba_collector *collectors, int n_collectors)
 	return (n_fds > 0) ? SUCCESS : FAILURE;
 } /* }}} */
 
-static inline int php_pinba_dict_find_or_add(HashTable *ht, char *word, size_t word_len) /* {{{ */
-{
-	size_t id, cnt;
-
-	id = (size_t)zend_hash_str_find_ptr(ht, word, word_len);
-	if (!id) {
-		cnt = zend_hash_num_elements(ht) + 1;
-
-		if (zend_hash_str_add_ptr(ht, word, word_len, (void *)cnt) == NULL) {
-			return -1;
-		}
-		return cnt - 1;
-	}
-	return id - 1;
-}
-/* }}} */
-
 static inline char *_pinba_fetch_global_var(char *name, int name_len) /* {{{ */
 {
 	char *res;
@@ -586,15 +2199,54 @@ static inline char *_pinba_fetch_global_var(char *name, int name_len) /* {{{ */
 }
 /* }}} */
 
+static int php_pinba_sketch_to_binary(const pinba_sketch *sketch, ProtobufCBinaryData *out) /* {{{ */
+{
+	out->len = pinba_sketch_serialized_size(sketch);
+	out->data = malloc(out->len);
+	if (!out->data) {
+		out->len = 0;
+		return FAILURE;
+	}
+	pinba_sketch_serialize(sketch, out->data);
+	return SUCCESS;
+}
+/* }}} */
+
+static void php_pinba_timer_aggs_free(pinba_timer_agg *aggs, int n_aggs) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < n_aggs; i++) {
+		if (aggs[i].hist) {
+			efree(aggs[i].hist);
+		}
+		if (aggs[i].sketch) {
+			pinba_sketch_destroy(aggs[i].sketch);
+			efree(aggs[i].sketch);
+		}
+	}
+	efree(aggs);
+}
+/* }}} */
+
 static inline Pinba__Request *php_create_pinba_packet(pinba_client_t *client, const char *custom_script_name, int flags) /* {{{ */
 {
-	HashTable dict, *tags, *timers, timers_uniq;
+	HashTable client_dict, *dict, *tags, *timers, *folded = NULL, timers_uniq;
 	HashPosition pos;
 	Pinba__Request *request;
 	char hostname[256], *tag_value;
 	pinba_req_data *req_data = &PINBA_G(tmp_req_data);
 	int timers_num, tags_cnt, *tag_ids = NULL, *tag_value_ids = NULL, i, n;
+	uint32_t *word_ids = NULL;
+	pinba_timer_agg *aggs = NULL;
+	int n_aggs = 0;
+	int n_counters = 0; /* aggregates of counter timers, see php_pinba_auto_count() */
+	zend_bool nesting = !client && PINBA_G(timer_nesting);
+	zend_bool histograms = PINBA_G(timer_histograms);
+	zend_bool sketches = PINBA_G(sketches);
+	size_t n_hist = 0, n_timer_tags = 0;
 	size_t id;
+	uint32_t dict_gen;
 
 	request = malloc(sizeof(Pinba__Request));
 	if (!request) {
@@ -643,6 +2295,11 @@ static inline Pinba__Request *php_create_pinba_packet(pinba_client_t *client, co
 
 		tags = &client->tags;
 		timers = &client->timers;
+
+		/* the ids are assigned for each packet, timers of the client may be sent more than once */
+		zend_hash_init(&client_dict, 10, NULL, NULL, 0);
+		dict = &client_dict;
+		dict_gen = 0;
 	} else {
 		struct timeval ru_utime = {0, 0}, ru_stime = {0, 0};
 		struct rusage u;
@@ -663,14 +2320,10 @@ static inline Pinba__Request *php_create_pinba_packet(pinba_client_t *client, co
 		if (PINBA_G(request_time) > 0) {
 			request->request_time = PINBA_G(request_time);
 		} else {
-			struct timeval request_finish, req_time;
-
-			gettimeofday(&request_finish, 0);
-			timersub(&request_finish, &req_data->req_start, &req_time);
-			request->request_time = timeval_to_float(req_time);
+			request->request_time = ns_to_float(php_pinba_clock_ns() - req_data->req_start);
 		}
 
-		if (getrusage(RUSAGE_SELF, &u) == 0) {
+		if (getrusage(PINBA_RUSAGE_WHO, &u) == 0) {
 			timersub(&u.ru_utime, &req_data->ru_utime, &ru_utime);
 			timersub(&u.ru_stime, &req_data->ru_stime, &ru_stime);
 		}
@@ -719,9 +2372,11 @@ static inline Pinba__Request *php_create_pinba_packet(pinba_client_t *client, co
 
 		tags = &PINBA_G(tags);
 		timers = &PINBA_G(timers);
+		folded = &PINBA_G(timers_folded);
+		dict = &PINBA_G(dict);
+		dict_gen = PINBA_G(dict_gen);
 	}
 
-	zend_hash_init(&dict, 10, NULL, NULL, 0);
 	tags_cnt = zend_hash_num_elements(tags);
 
 	if (tags_cnt) {
@@ -739,7 +2394,7 @@ static inline Pinba__Request *php_create_pinba_packet(pinba_client_t *client, co
 			zend_ulong num_key;
 			int word_id;
 
-			word_id = php_pinba_dict_find_or_add(&dict, tag_value, strlen(tag_value));
+			word_id = php_pinba_dict_find_or_add(dict, tag_value, strlen(tag_value));
 			if (word_id < 0) {
 				continue;
 			}
@@ -747,7 +2402,7 @@ static inline Pinba__Request *php_create_pinba_packet(pinba_client_t *client, co
 			tag_value_ids[tag_num] = word_id;
 
 			if (zend_hash_get_current_key_ex(tags, &key, &num_key, &pos) == HASH_KEY_IS_STRING) {
-				word_id = php_pinba_dict_find_or_add(&dict, key->val, key->len);
+				word_id = php_pinba_dict_find_or_add(dict, key->val, key->len);
 				if (word_id < 0) {
 					continue;
 				}
@@ -758,89 +2413,166 @@ static inline Pinba__Request *php_create_pinba_packet(pinba_client_t *client, co
 		tags_cnt = tag_num;
 	}
 
-	timers_num = zend_hash_num_elements(timers);
+	timers_num = zend_hash_num_elements(timers) + (folded ? zend_hash_num_elements(folded) : 0);
 	if (timers_num > 0) {
-		pinba_timer_t *t, *old_t;
-		char *hashed_tags;
-		size_t hashed_tags_len;
+		pinba_timer_t *t;
+		pinba_timer_agg *agg;
+		int64_t now, value;
+		zend_ulong h;
+		unsigned int parent;
+		HashTable *sources[2];
+		int src;
 
-		/* make sure we send aggregated timers to the server */
-		zend_hash_init(&timers_uniq, 10, NULL, NULL, 0);
+		aggs = ecalloc(timers_num, sizeof(pinba_timer_agg));
+		now = php_pinba_clock_ns();
 
-		for (zend_hash_internal_pointer_reset_ex(timers, &pos);
-				(t = zend_hash_get_current_data_ptr_ex(timers, &pos)) != NULL;
-				zend_hash_move_forward_ex(timers, &pos)) {
+		/* make sure we send aggregated timers to the server, nested timers are aggregated per parent */
+		zend_hash_init(&timers_uniq, 10, NULL, NULL, 0);
 
+		sources[0] = timers;
+		sources[1] = folded;
+		for (src = 0; src < 2 && sources[src]; src++) {
+		ZEND_HASH_FOREACH_PTR(sources[src], t) {
 			/* aggregate only stopped timers */
 			if ((flags & PINBA_FLUSH_ONLY_STOPPED_TIMERS) != 0 && t->started) {
 				continue;
 			}
 
-			if (php_pinba_tags_to_hashed_string(t->tags, t->tags_num, &hashed_tags, &hashed_tags_len) != SUCCESS) {
+			if (!t->tags) {
 				continue;
 			}
 
-			old_t = zend_hash_str_find_ptr(&timers_uniq, hashed_tags, hashed_tags_len);
-			if (old_t != NULL) {
-				timeradd(&old_t->value, &t->value, &old_t->value);
-				timeradd(&old_t->ru_utime, &t->ru_utime, &old_t->ru_utime);
-				timeradd(&old_t->ru_stime, &t->ru_stime, &old_t->ru_stime);
-				if (t->hit_count) {
-					old_t->hit_count += t->hit_count;
-				} else {
-					old_t->hit_count++;
+			/* parents are created before their children, so a parent sent in this packet is already indexed */
+			parent = (nesting && t->parent && t->parent->packet_index >= 0) ? t->parent->packet_index + 1 : 0;
+
+			h = t->tags->hash + parent;
+			while ((agg = zend_hash_index_find_ptr(&timers_uniq, h)) != NULL) {
+				if (agg->parent == parent && php_pinba_tags_equal(agg->tags, t->tags)) {
+					break;
 				}
+				h++;
+			}
+
+			value = t->value;
+			if (t->started) {
+				value += now - t->start;
+			}
+
+			if (agg) {
+				agg->hit_count += t->hit_count ? t->hit_count : 1;
 			} else {
-				zend_hash_str_add_ptr(&timers_uniq, hashed_tags, hashed_tags_len, t);
+				agg = &aggs[n_aggs++];
+				agg->tags = t->tags;
+				agg->parent = parent;
+				n_timer_tags += t->tags->num;
+				agg->hit_count = t->hit_count;
+				if (histograms) {
+					agg->hist = ecalloc(1, sizeof(pinba_histogram));
+				}
+				if (sketches) {
+					agg->sketch = emalloc(sizeof(pinba_sketch));
+					pinba_sketch_init(agg->sketch, PINBA_SKETCH_DEFAULT_ALPHA);
+				}
+				zend_hash_index_add_ptr(&timers_uniq, h, agg);
 			}
-			efree(hashed_tags);
-		}
+			agg->value += value;
+			agg->self_value += (value > t->children_value) ? value - t->children_value : 0;
+			agg->ru_utime += t->ru_utime;
+			agg->ru_stime += t->ru_stime;
+			if (t->counter) {
+				n_counters += !agg->counter;
+				agg->counter = 1;
+				agg->count += t->count;
+				t->packet_index = agg - aggs;
+				continue;
+			}
+			if (histograms) {
+				if (t->hist) {
+					php_pinba_histogram_merge(agg->hist, t->hist);
+				} else {
+					/* all we know about a timer with several hits is their average */
+					unsigned int hits = t->hit_count ? t->hit_count : 1;
 
-		/* create our temporary dictionary and add ids to timers */
-		for (zend_hash_internal_pointer_reset_ex(&timers_uniq, &pos);
-				(t = zend_hash_get_current_data_ptr_ex(&timers_uniq, &pos)) != NULL;
-				zend_hash_move_forward_ex(&timers_uniq, &pos)) {
-			for (i = 0; i < t->tags_num; i++) {
-				int word_id;
+					php_pinba_histogram_add(agg->hist, value / hits, hits);
+				}
+			}
+			if (sketches) {
+				if (t->sketch) {
+					pinba_sketch_merge(agg->sketch, t->sketch);
+				} else {
+					unsigned int hits = t->hit_count ? t->hit_count : 1;
 
-				word_id = php_pinba_dict_find_or_add(&dict, t->tags[i]->name, t->tags[i]->name_len);
-				if (word_id < 0) {
-					break;
+					pinba_sketch_add(agg->sketch, ns_to_float(value) / hits, hits);
 				}
-				t->tags[i]->name_id = word_id;
+			}
+			t->packet_index = agg - aggs;
+		} ZEND_HASH_FOREACH_END();
+		}
 
-				word_id = php_pinba_dict_find_or_add(&dict, t->tags[i]->value, t->tags[i]->value_len);
-				if (word_id < 0) {
-					break;
+		ZEND_HASH_FOREACH_PTR(timers, t) {
+			t->packet_index = -1;
+		} ZEND_HASH_FOREACH_END();
+		zend_hash_destroy(&timers_uniq);
+
+		/* most timers got their ids when they were stopped */
+		for (n = 0; n < n_aggs; n++) {
+			agg = &aggs[n];
+			if (agg->hist) {
+				for (i = 0; i < PINBA_HISTOGRAM_BUCKETS; i++) {
+					n_hist += agg->hist->counts[i] != 0;
 				}
-				t->tags[i]->value_id = word_id;
 			}
+			php_pinba_tags_encode(agg->tags, dict, dict_gen);
 		}
 	}
 
-	n = zend_hash_num_elements(&dict);
+	n = zend_hash_num_elements(dict);
 
-	request->dictionary = malloc(sizeof(char *) * n);
+	request->dictionary = malloc(sizeof(char *) * (n ? n : 1));
 	if (!request->dictionary) {
+		if (aggs) {
+			php_pinba_timer_aggs_free(aggs, n_aggs);
+		}
+		if (dict == &client_dict) {
+			zend_hash_destroy(&client_dict);
+		}
+		if (tags_cnt) {
+			efree(tag_ids);
+			efree(tag_value_ids);
+		}
 		pinba__request__free_unpacked(request, NULL);
 		return NULL;
 	}
 
+	/* PINBA_G(dict) also has the words of timers deleted, retagged or left out of this packet,
+	   only the words the packet refers to are sent; word_ids maps dictionary ids to packet ids + 1 */
+	word_ids = ecalloc(n ? n : 1, sizeof(uint32_t));
+	for (i = 0; i < tags_cnt; i++) {
+		word_ids[tag_ids[i]] = word_ids[tag_value_ids[i]] = 1;
+	}
+	for (n = 0; n < n_aggs; n++) {
+		for (i = 0; i < aggs[n].tags->num; i++) {
+			word_ids[aggs[n].tags->tag[i].name_id] = word_ids[aggs[n].tags->tag[i].value_id] = 1;
+		}
+	}
+
+	/* the words are in the order of their ids */
 	n = 0;
-	for (zend_hash_internal_pointer_reset_ex(&dict, &pos);
-			(id = (size_t)zend_hash_get_current_data_ex(&dict, &pos) != 0);
-			zend_hash_move_forward_ex(&dict, &pos)) {
+	id = 0;
+	for (zend_hash_internal_pointer_reset_ex(dict, &pos);
+			zend_hash_get_current_data_ex(dict, &pos) != NULL;
+			zend_hash_move_forward_ex(dict, &pos), id++) {
 		zend_string *str;
 		zend_ulong num_key;
 
-		if (zend_hash_get_current_key_ex(&dict, &str, &num_key, &pos) == HASH_KEY_IS_STRING) {
+		if (word_ids[id] && zend_hash_get_current_key_ex(dict, &str, &num_key, &pos) == HASH_KEY_IS_STRING) {
 			request->dictionary[n] = strndup(str->val, str->len);
-			n++;
-		} else {
-			continue;
+			word_ids[id] = ++n;
 		}
 	}
-	zend_hash_destroy(&dict);
+	if (dict == &client_dict) {
+		zend_hash_destroy(&client_dict);
+	}
 	request->n_dictionary = n;
 
 	if (tags_cnt) {
@@ -851,67 +2583,140 @@ static inline Pinba__Request *php_create_pinba_packet(pinba_client_t *client, co
 		request->n_tag_value = tags_cnt;
 
 		for (i = 0; i < tags_cnt; i++) {
-			request->tag_name[i] = tag_ids[i];
-			request->tag_value[i] = tag_value_ids[i];
+			request->tag_name[i] = word_ids[tag_ids[i]] - 1;
+			request->tag_value[i] = word_ids[tag_value_ids[i]] - 1;
 		}
 		efree(tag_ids);
 		efree(tag_value_ids);
 	}
 
 	/* timers */
-	if (timers_num > 0) {
-		pinba_timer_t *t;
+	if (n_aggs > 0) {
+		pinba_timer_agg *agg;
 
-		n = zend_hash_num_elements(&timers_uniq);
+		n = n_aggs;
 		request->timer_hit_count = malloc(sizeof(unsigned int) * n);
 		request->timer_tag_count = malloc(sizeof(unsigned int) * n);
 		request->timer_ru_stime = malloc(sizeof(float) * n);
 		request->timer_ru_utime = malloc(sizeof(float) * n);
-		request->timer_tag_name = NULL;
-		request->timer_tag_value = NULL;
+		request->timer_tag_name = malloc(sizeof(unsigned int) * (n_timer_tags ? n_timer_tags : 1));
+		request->timer_tag_value = malloc(sizeof(unsigned int) * (n_timer_tags ? n_timer_tags : 1));
 		request->timer_value = malloc(sizeof(float) * n);
+		if (nesting) {
+			request->timer_parent = malloc(sizeof(unsigned int) * n);
+			request->timer_self_value = malloc(sizeof(float) * n);
+		}
+		if (histograms) {
+			request->timer_hist_count = malloc(sizeof(unsigned int) * n);
+			request->timer_hist_bucket = malloc(sizeof(unsigned int) * (n_hist ? n_hist : 1));
+			request->timer_hist_hits = malloc(sizeof(unsigned int) * (n_hist ? n_hist : 1));
+			request->timer_min_value = malloc(sizeof(float) * n);
+			request->timer_max_value = malloc(sizeof(float) * n);
+		}
 
-		if (!request->timer_hit_count || !request->timer_tag_count || !request->timer_value || !request->timer_ru_stime || !request->timer_ru_utime) {
+		if (!request->timer_hit_count || !request->timer_tag_count || !request->timer_value || !request->timer_ru_stime || !request->timer_ru_utime
+				|| !request->timer_tag_name || !request->timer_tag_value
+				|| (nesting && (!request->timer_parent || !request->timer_self_value))
+				|| (histograms && (!request->timer_hist_count || !request->timer_hist_bucket || !request->timer_hist_hits || !request->timer_min_value || !request->timer_max_value))) {
+			php_pinba_timer_aggs_free(aggs, n_aggs);
+			efree(word_ids);
 			pinba__request__free_unpacked(request, NULL);
 			return NULL;
 		}
 
-		n = 0;
-		for (zend_hash_internal_pointer_reset_ex(&timers_uniq, &pos);
-				(t = zend_hash_get_current_data_ptr_ex(&timers_uniq, &pos)) != NULL;
-				zend_hash_move_forward_ex(&timers_uniq, &pos)) {
+		for (n = 0; n < n_aggs; n++) {
+			agg = &aggs[n];
+
+			for (i = 0; i < agg->tags->num; i++) {
+				request->timer_tag_name[request->n_timer_tag_name + i] = word_ids[agg->tags->tag[i].name_id] - 1;
+				request->timer_tag_value[request->n_timer_tag_value + i] = word_ids[agg->tags->tag[i].value_id] - 1;
+			}
+
+			request->n_timer_tag_name += i;
+			request->n_timer_tag_value += i;
 
-			request->timer_tag_name = realloc(request->timer_tag_name, sizeof(unsigned int) * (request->n_timer_tag_name + t->tags_num));
-			request->timer_tag_value = realloc(request->timer_tag_value, sizeof(unsigned int) * (request->n_timer_tag_value + t->tags_num));
+			request->timer_tag_count[n] = i;
+			request->timer_hit_count[n] = agg->hit_count;
+			request->timer_value[n] = ns_to_float(agg->value);
+			request->timer_ru_utime[n] = ns_to_float(agg->ru_utime);
+			request->timer_ru_stime[n] = ns_to_float(agg->ru_stime);
+			if (nesting) {
+				request->timer_parent[n] = agg->parent;
+				request->timer_self_value[n] = ns_to_float(agg->self_value);
+			}
+			if (histograms) {
+				request->timer_hist_count[n] = 0;
+				for (i = 0; i < PINBA_HISTOGRAM_BUCKETS; i++) {
+					if (agg->hist->counts[i]) {
+						request->timer_hist_bucket[request->n_timer_hist_bucket++] = i;
+						request->timer_hist_hits[request->n_timer_hist_hits++] = agg->hist->counts[i];
+						request->timer_hist_count[n]++;
+					}
+				}
+				request->timer_min_value[n] = ns_to_float(agg->hist->min);
+				request->timer_max_value[n] = ns_to_float(agg->hist->max);
+			}
+		}
+		request->n_timer_tag_count = n;
+		request->n_timer_hit_count = n;
+		request->n_timer_ru_utime = n;
+		request->n_timer_ru_stime = n;
+		request->n_timer_value = n;
+		if (nesting) {
+			request->n_timer_parent = n;
+			request->n_timer_self_value = n;
+		}
+		if (histograms) {
+			request->n_timer_hist_count = n;
+			request->n_timer_min_value = n;
+			request->n_timer_max_value = n;
+		}
 
-			if (!request->timer_tag_name || !request->timer_tag_value) {
-				pinba__request__free_unpacked(request, NULL);
-				return NULL;
+		if (n_counters) {
+			/* all or nothing like the sketches, counts are matched to timers by index */
+			request->timer_counter = malloc(sizeof(uint64_t) * n);
+			if (request->timer_counter) {
+				for (i = 0; i < n; i++) {
+					request->timer_counter[i] = aggs[i].count;
+				}
+				request->n_timer_counter = n;
 			}
+		}
 
-			for (i = 0; i < t->tags_num; i++) {
-				request->timer_tag_name[request->n_timer_tag_name + i] = t->tags[i]->name_id;
-				request->timer_tag_value[request->n_timer_tag_value + i] = t->tags[i]->value_id;
+		if (sketches) {
+			request->timer_sketch = malloc(sizeof(ProtobufCBinaryData) * n);
+			for (i = 0; request->timer_sketch && i < n; i++) {
+				if (php_pinba_sketch_to_binary(aggs[i].sketch, &request->timer_sketch[i]) != SUCCESS) {
+					/* all or nothing, sketches are matched to timers by index */
+					while (--i >= 0) {
+						free(request->timer_sketch[i].data);
+					}
+					free(request->timer_sketch);
+					request->timer_sketch = NULL;
+					break;
+				}
+			}
+			if (request->timer_sketch) {
+				request->n_timer_sketch = n;
 			}
+		}
+	}
 
-			request->n_timer_tag_name += i;
-			request->n_timer_tag_value += i;
+	if (sketches) {
+		pinba_sketch sketch;
 
-			request->timer_tag_count[n] = i;
-			request->timer_hit_count[n] = t->hit_count;
-			request->timer_value[n] = timeval_to_float(t->value);
-			request->timer_ru_utime[n] = timeval_to_float(t->ru_utime);
-			request->timer_ru_stime[n] = timeval_to_float(t->ru_stime);
-			n++;
+		pinba_sketch_init(&sketch, PINBA_SKETCH_DEFAULT_ALPHA);
+		pinba_sketch_add(&sketch, request->request_time, 1);
+		if (php_pinba_sketch_to_binary(&sketch, &request->request_time_sketch) == SUCCESS) {
+			request->has_request_time_sketch = 1;
 		}
-		request->n_timer_tag_count = n;
-		request->n_timer_hit_count = n;
-		request->n_timer_ru_utime = n;
-		request->n_timer_ru_stime = n;
-		request->n_timer_value = n;
-		zend_hash_destroy(&timers_uniq);
+		pinba_sketch_destroy(&sketch);
 	}
 
+	if (aggs) {
+		php_pinba_timer_aggs_free(aggs, n_aggs);
+	}
+	efree(word_ids);
 	return request;
 }
 /* }}} */
@@ -996,14 +2801,11 @@ static inline void php_pinba_req_data_dtor(pinba_req_data *record) /* {{{ */
 
 static inline void php_pinba_reset_data(void) /* {{{ */
 {
-	struct timeval t;
 	struct rusage u;
 
-	if (gettimeofday(&t, 0) == 0) {
-		timeval_cvt(&(PINBA_G(tmp_req_data).req_start), &t);
-	}
+	PINBA_G(tmp_req_data).req_start = php_pinba_clock_ns();
 
-	if (getrusage(RUSAGE_SELF, &u) == 0) {
+	if (getrusage(PINBA_RUSAGE_WHO, &u) == 0) {
 		timeval_cvt(&(PINBA_G(tmp_req_data).ru_utime), &u.ru_utime);
 		timeval_cvt(&(PINBA_G(tmp_req_data).ru_stime), &u.ru_stime);
 	}
@@ -1019,15 +2821,13 @@ static inline void php_pinba_reset_data(void) /* {{{ */
 
 static void php_pinba_flush_data(const char *custom_script_name, long flags) /* {{{ */
 {
-	struct timeval now;
-	struct rusage u;
+	int64_t now;
+	pinba_cpu_sample cpu;
 
-	if (gettimeofday(&now, 0) != 0 || getrusage(RUSAGE_SELF, &u) != 0) {
-		return;
-	}
+	now = php_pinba_clock_ns();
 
 	/* stop all running timers */
-	zend_hash_apply_with_arguments(&EG(regular_list), (apply_func_args_t) php_pinba_timer_stop_helper, 3, (void *)flags, (void *)&now, (void *)&u);
+	php_pinba_timers_collect(flags, &now, php_pinba_cpu_sample(&cpu) == SUCCESS ? &cpu : NULL);
 
 	/* prevent any further access to the timers */
 	PINBA_G(timers_stopped) = 1;
@@ -1035,12 +2835,15 @@ static void php_pinba_flush_data(const char *custom_script_name, long flags) /*
 	if (!PINBA_G(enabled) || PINBA_G(n_collectors) == 0) {
 		/* disabled or no collectors defined, exit */
 		zend_hash_clean(&PINBA_G(timers));
-		zend_hash_apply(&EG(regular_list), (apply_func_t) php_pinba_timer_delete_helper);
+		php_pinba_timers_delete();
 		PINBA_G(timers_stopped) = 0;
 		return;
 	}
 
 	if (php_pinba_init_socket(PINBA_G(collectors), PINBA_G(n_collectors)) != SUCCESS) {
+		/* the data can't be sent, drop it the same way */
+		zend_hash_clean(&PINBA_G(timers));
+		php_pinba_timers_delete();
 		PINBA_G(timers_stopped) = 0;
 		return;
 	}
@@ -1052,7 +2855,7 @@ static void php_pinba_flush_data(const char *custom_script_name, long flags) /*
 	}
 
 	/* delete all stopped timers */
-	zend_hash_apply(&EG(regular_list), (apply_func_t) php_pinba_timer_delete_helper);
+	php_pinba_timers_delete();
 
 	PINBA_G(timers_stopped) = 0;
 	zend_hash_clean(&PINBA_G(timers));
@@ -1085,104 +2888,378 @@ static int php_pinba_key_compare(const void *a, const void *b) /* {{{ */
 }
 /* }}} */
 
-static int php_pinba_array_to_tags(HashTable *array, pinba_timer_tag_t ***tags) /* {{{ */
+typedef struct _pinba_tag_src { /* {{{ */
+	zend_string *name;
+	const char *value; /* the string itself, a constant or the number printed into the numbers buffer */
+	size_t value_len;
+	zend_string *value_str; /* converted doubles, released once the tags are built */
+} pinba_tag_src;
+/* }}} */
+
+#define PINBA_TAGS_ON_STACK 16
+#define PINBA_TAG_NUMBER_SIZE (MAX_LENGTH_OF_LONG + 1)
+
+static int php_pinba_tag_src_compare(const void *a, const void *b) /* {{{ */
+{
+	const pinba_tag_src *f = (const pinba_tag_src *)a;
+	const pinba_tag_src *s = (const pinba_tag_src *)b;
+
+	return zend_binary_strcmp(ZSTR_VAL(f->name), ZSTR_LEN(f->name), ZSTR_VAL(s->name), ZSTR_LEN(s->name));
+}
+/* }}} */
+
+static void php_pinba_tag_src_swap(void *a, void *b) /* {{{ */
+{
+	pinba_tag_src tmp = *(pinba_tag_src *)a;
+
+	*(pinba_tag_src *)a = *(pinba_tag_src *)b;
+	*(pinba_tag_src *)b = tmp;
+}
+/* }}} */
+
+/* timer tags are allocated from the arena, temporary and PinbaClient ones with arena == NULL */
+static int php_pinba_array_to_tags(HashTable *array, pinba_timer_tags_t **tags, pinba_arena *arena) /* {{{ */
 {
 	int num, i = 0;
 	zval *value;
 	zend_string *tag_name_str;
+	pinba_tag_src src_buf[PINBA_TAGS_ON_STACK], *src;
+	char numbers_buf[PINBA_TAGS_ON_STACK * PINBA_TAG_NUMBER_SIZE], *numbers;
+	size_t blob_len = 0, blob_pos = 0;
+	int result = FAILURE;
 
 	num = zend_hash_num_elements(array);
 	if (!num) {
 		return FAILURE;
 	}
 
-	/* sort array, we'll use this when computing tags hash */
-	zend_hash_sort(array, php_pinba_key_compare, 0);
+	if (num <= PINBA_TAGS_ON_STACK) {
+		src = src_buf;
+		numbers = numbers_buf;
+	} else {
+		src = (pinba_tag_src *)safe_emalloc(num, sizeof(pinba_tag_src) + PINBA_TAG_NUMBER_SIZE, 0);
+		numbers = (char *)(src + num);
+	}
 
-	*tags = (pinba_timer_tag_t **)ecalloc(num, sizeof(pinba_timer_tag_t *));
 	ZEND_HASH_FOREACH_STR_KEY_VAL_IND(array, tag_name_str, value) {
-		zend_string *str;
-
+		/* ints, booleans and strings are used as they are, without a temporary string */
+		src[i].value_str = NULL;
 		switch (Z_TYPE_P(value)) {
-			case IS_NULL:
 			case IS_STRING:
+				src[i].value = Z_STRVAL_P(value);
+				src[i].value_len = Z_STRLEN_P(value);
+				break;
+			case IS_LONG: {
+				char *end = numbers + (i + 1) * PINBA_TAG_NUMBER_SIZE - 1;
+
+				*end = '\0';
+				src[i].value = zend_print_long_to_buf(end, Z_LVAL_P(value));
+				src[i].value_len = end - src[i].value;
+				break;
+			}
 			case IS_TRUE:
+				src[i].value = "1";
+				src[i].value_len = 1;
+				break;
+			case IS_NULL:
 			case IS_FALSE:
-			case IS_LONG:
+				src[i].value = "";
+				src[i].value_len = 0;
+				break;
 			case IS_DOUBLE:
-				str = zval_get_string(value);
+				src[i].value_str = zval_get_string(value);
+				src[i].value = ZSTR_VAL(src[i].value_str);
+				src[i].value_len = ZSTR_LEN(src[i].value_str);
 				break;
 			default:
 				php_error_docref(NULL, E_WARNING, "tags cannot have non-scalar values");
-				php_pinba_timer_tags_dtor(*tags, i);
-				efree(*tags);
-				return FAILURE;
+				goto cleanup;
 		}
 
-		if (tag_name_str) {
-			(*tags)[i] = (pinba_timer_tag_t *)emalloc(sizeof(pinba_timer_tag_t));
-			(*tags)[i]->name = estrndup(tag_name_str->val, tag_name_str->len);
-			(*tags)[i]->name_len = tag_name_str->len;
-			(*tags)[i]->value = estrndup(str->val, str->len);
-			(*tags)[i]->value_len = str->len;
-			zend_string_release(str);
-		} else {
-			zend_string_release(str);
+		if (!tag_name_str) {
+			if (src[i].value_str) {
+				zend_string_release(src[i].value_str);
+			}
 			php_error_docref(NULL, E_WARNING, "tags can only have string names (i.e. tags array cannot contain numeric indexes)");
-			php_pinba_timer_tags_dtor(*tags, i);
-			efree(*tags);
-			return FAILURE;
+			goto cleanup;
 		}
+
+		src[i].name = tag_name_str;
+		blob_len += ZSTR_LEN(tag_name_str) + 1 + src[i].value_len + 1;
 		i++;
 	} ZEND_HASH_FOREACH_END();
+
+	/* keep our own copy sorted by name, we'll use this when computing tags hash and merging */
+	zend_sort(src, num, sizeof(pinba_tag_src), php_pinba_tag_src_compare, php_pinba_tag_src_swap);
+
+	if (arena) {
+		*tags = (pinba_timer_tags_t *)php_pinba_arena_alloc(arena, PINBA_TAGS_SIZE(num, blob_len));
+	} else {
+		*tags = (pinba_timer_tags_t *)emalloc(PINBA_TAGS_SIZE(num, blob_len));
+	}
+	(*tags)->num = num;
+	(*tags)->blob_len = blob_len;
+	(*tags)->dict_gen = 0;
+	for (i = 0; i < num; i++) {
+		php_pinba_tags_set(*tags, i, &blob_pos, ZSTR_VAL(src[i].name), ZSTR_LEN(src[i].name), src[i].value, src[i].value_len);
+	}
+	php_pinba_tags_hash(*tags);
+	result = SUCCESS;
+
+cleanup:
+	while (i-- > 0) {
+		if (src[i].value_str) {
+			zend_string_release(src[i].value_str);
+		}
+	}
+	if (src != src_buf) {
+		efree(src);
+	}
+	return result;
+}
+/* }}} */
+
+/* tags arguments are arrays or PinbaTagSet objects, returns the number of tags or -1 for anything else */
+static int php_pinba_tags_param(zval *tags) /* {{{ */
+{
+	if (Z_TYPE_P(tags) == IS_ARRAY) {
+		return zend_hash_num_elements(Z_ARRVAL_P(tags));
+	}
+	if (Z_TYPE_P(tags) == IS_OBJECT && Z_OBJCE_P(tags) == pinba_tagset_ce) {
+		return php_pinba_tagset_object(Z_OBJ_P(tags))->tags->num;
+	}
+	php_error_docref(NULL, E_WARNING, "tags must be an array or a PinbaTagSet, %s given", zend_zval_type_name(tags));
+	return -1;
+}
+/* }}} */
+
+/* same as php_pinba_array_to_tags(), a PinbaTagSet is copied as is */
+static int php_pinba_zval_to_tags(zval *tags_zv, pinba_timer_tags_t **tags, pinba_arena *arena) /* {{{ */
+{
+	pinba_timer_tags_t *src;
+	size_t size;
+
+	if (Z_TYPE_P(tags_zv) == IS_ARRAY) {
+		return php_pinba_array_to_tags(Z_ARRVAL_P(tags_zv), tags, arena);
+	}
+
+	src = php_pinba_tagset_object(Z_OBJ_P(tags_zv))->tags;
+	size = PINBA_TAGS_SIZE(src->num, src->blob_len);
+	*tags = (pinba_timer_tags_t *)(arena ? php_pinba_arena_alloc(arena, size) : emalloc(size));
+	memcpy(*tags, src, size);
+	return SUCCESS;
+}
+/* }}} */
+
+static zend_object *pinba_tagset_new(zend_class_entry *ce) /* {{{ */
+{
+	pinba_tagset_object *intern;
+
+	intern = ecalloc(1, sizeof(pinba_tagset_object) + zend_object_properties_size(ce));
+
+	zend_object_std_init(&intern->std, ce);
+	object_properties_init(&intern->std, ce);
+	intern->std.handlers = &pinba_tagset_handlers;
+	return &intern->std;
+}
+/* }}} */
+
+static void pinba_tagset_free_storage(zend_object *object) /* {{{ */
+{
+	pinba_tagset_object *intern = php_pinba_tagset_object(object);
+
+	if (intern->tags) {
+		efree(intern->tags);
+	}
+	zend_object_std_dtor(&intern->std);
+}
+/* }}} */
+
+static zend_function *pinba_tagset_get_constructor(zend_object *object) /* {{{ */
+{
+	zend_throw_error(NULL, "Cannot directly construct PinbaTagSet, use pinba_tagset_create() instead");
+	return NULL;
+}
+/* }}} */
+
+/* merge two sorted tag sets into a new one in PINBA_G(timers_arena), values from new_tags win */
+static pinba_timer_tags_t *php_pinba_tags_merge(pinba_timer_tags_t *old_tags, pinba_timer_tags_t *new_tags) /* {{{ */
+{
+	pinba_timer_tags_t *tags;
+	int i = 0, j = 0, n = 0;
+	size_t blob_pos = 0;
+
+	tags = (pinba_timer_tags_t *)php_pinba_timers_alloc(PINBA_TAGS_SIZE(old_tags->num + new_tags->num, old_tags->blob_len + new_tags->blob_len));
+	/* the blob is placed after the maximum number of tags, shrunk below */
+	tags->num = old_tags->num + new_tags->num;
+	tags->dict_gen = 0;
+
+	while (i < old_tags->num || j < new_tags->num) {
+		pinba_timer_tags_t *from;
+		int k, cmp;
+
+		if (i == old_tags->num) {
+			cmp = 1;
+		} else if (j == new_tags->num) {
+			cmp = -1;
+		} else {
+			cmp = zend_binary_strcmp(PINBA_TAG_NAME(old_tags, i), old_tags->tag[i].name_len, PINBA_TAG_NAME(new_tags, j), new_tags->tag[j].name_len);
+		}
+
+		if (cmp < 0) {
+			from = old_tags;
+			k = i++;
+		} else {
+			from = new_tags;
+			k = j++;
+			if (cmp == 0) {
+				i++;
+			}
+		}
+		php_pinba_tags_set(tags, n++, &blob_pos, PINBA_TAG_NAME(from, k), from->tag[k].name_len, PINBA_TAG_VALUE(from, k), from->tag[k].value_len);
+	}
+
+	if (n < tags->num) {
+		/* some names were replaced, move the blob right after the last tag */
+		memmove((char *)(tags->tag + n), PINBA_TAGS_BLOB(tags), blob_pos);
+		tags->num = n;
+	}
+	tags->blob_len = blob_pos;
+	php_pinba_tags_hash(tags);
+	return tags;
+}
+/* }}} */
+
+static int php_pinba_timer_options(HashTable *options, zend_bool *cpu) /* {{{ */
+{
+	zend_string *key;
+	zval *value;
+
+	ZEND_HASH_FOREACH_STR_KEY_VAL(options, key, value) {
+		if (key && zend_string_equals_literal(key, "cpu")) {
+			*cpu = zend_is_true(value);
+		} else {
+			php_error_docref(NULL, E_WARNING, "unknown timer option '%s'", key ? ZSTR_VAL(key) : "(numeric)");
+			return FAILURE;
+		}
+	} ZEND_HASH_FOREACH_END();
 	return SUCCESS;
 }
 /* }}} */
 
-static pinba_timer_t *php_pinba_timer_ctor(pinba_timer_tag_t **tags, int tags_num) /* {{{ */
+static zend_object *pinba_timer_new(zend_class_entry *ce) /* {{{ */
+{
+	pinba_timer_object *intern;
+
+	intern = ecalloc(1, sizeof(pinba_timer_object) + zend_object_properties_size(ce));
+
+	zend_object_std_init(&intern->std, ce);
+	object_properties_init(&intern->std, ce);
+	intern->std.handlers = &pinba_timer_handlers;
+	return &intern->std;
+}
+/* }}} */
+
+static void pinba_timer_free_storage(zend_object *object) /* {{{ */
+{
+	pinba_timer_t *t = &php_pinba_timer_object(object)->timer;
+
+	/* only the request shutdown frees timers that are still linked */
+	if (t->started) {
+		PINBA_TIMER_LIST_REMOVE(PINBA_G(running_timers_list), t, running_link);
+		if (PINBA_G(timer_stack_top) == t) {
+			php_pinba_timer_stack_pop(t);
+		}
+	}
+	if (t->linked) {
+		/* dropped by the script after it has been stopped, the request shutdown frees the rest */
+		if (t->weak && !t->deleted && !PINBA_G(in_rshutdown)) {
+			php_pinba_timer_fold(t, NULL);
+		}
+		PINBA_TIMER_LIST_REMOVE(PINBA_G(timers_list), t, link);
+	}
+	/* collected for a flush or pinba_get_data() that hasn't run to the end */
+	if (t->deleted && !PINBA_G(in_rshutdown)) {
+		zend_hash_index_del(&PINBA_G(timers), object->handle);
+	}
+
+	if (t->parent) {
+		OBJ_RELEASE(PINBA_TIMER_ZOBJ(t->parent));
+	}
+
+	if (t->stack_prev) {
+		OBJ_RELEASE(PINBA_TIMER_ZOBJ(t->stack_prev));
+	}
+
+	if (!Z_ISUNDEF(t->data)) {
+		zval_ptr_dtor(&t->data);
+	}
+
+	if (t->sketch) {
+		pinba_sketch_destroy(t->sketch);
+		efree(t->sketch);
+	}
+
+	if (t->hist) {
+		php_pinba_timers_free(t->hist);
+	}
+
+	if (t->tags) {
+		php_pinba_timers_free(t->tags);
+	}
+
+	zend_object_std_dtor(&php_pinba_timer_object(object)->std);
+}
+/* }}} */
+
+static zend_function *pinba_timer_get_constructor(zend_object *object) /* {{{ */
+{
+	zend_throw_error(NULL, "Cannot directly construct PinbaTimer, use PinbaTimer::start() or PinbaTimer::add() instead");
+	return NULL;
+}
+/* }}} */
+
+static pinba_timer_t *php_pinba_timer_ctor(pinba_timer_tags_t *tags) /* {{{ */
 {
-	struct timeval now;
 	pinba_timer_t *t;
 
-	t = (pinba_timer_t *)ecalloc(1, sizeof(pinba_timer_t));
-	t->tags_num = tags_num;
+	t = &php_pinba_timer_object(pinba_timer_new(pinba_timer_ce))->timer;
 	t->tags = tags;
 
-	gettimeofday(&now, 0);
-	timeval_cvt(&t->start, &now);
+	t->packet_index = -1;
+
+	/* the timer is sent on flush even if the script doesn't keep it, so the list holds a reference too */
+	PINBA_GC_ADDREF(PINBA_TIMER_ZOBJ(t));
+	t->linked = 1;
+	PINBA_TIMER_LIST_APPEND(PINBA_G(timers_list), t, link);
 
+	t->start = php_pinba_clock_ns();
 	return t;
 }
 /* }}} */
 
-static void php_pinba_get_timer_info(pinba_timer_t *t, zval *info, struct timeval *pnow) /* {{{ */
+static void php_pinba_get_timer_info(pinba_timer_t *t, zval *info, const int64_t *pnow) /* {{{ */
 {
 	zval tags;
-	pinba_timer_tag_t *tag;
-	struct timeval tmp;
+	int64_t value;
 	int i;
 
 	array_init(info);
 
 	if (t->started) {
-		if (pnow) {
-			tmp = *pnow;
-		} else {
-			gettimeofday(&tmp, 0);
-		}
-
-		timersub(&tmp, &t->start, &tmp);
-		timeradd(&t->value, &tmp, &tmp);
+		value = t->value + (pnow ? *pnow : php_pinba_clock_ns()) - t->start;
 	} else {
-		timeval_cvt(&tmp, &t->value);
+		value = t->value;
+	}
+	add_assoc_double(info, "value", ns_to_float(value));
+	if (t->counter) {
+		add_assoc_long(info, "counter", (zend_long)t->count);
 	}
-	add_assoc_double(info, "value", timeval_to_float(tmp));
 
 	array_init(&tags);
 
-	for (i = 0; i < t->tags_num; i++) {
-		tag = t->tags[i];
-		add_assoc_stringl(&tags, tag->name, tag->value, tag->value_len);
+	for (i = 0; i < t->tags->num; i++) {
+		add_assoc_stringl_ex(&tags, PINBA_TAG_NAME(t->tags, i), t->tags->tag[i].name_len, PINBA_TAG_VALUE(t->tags, i), t->tags->tag[i].value_len);
 	}
 
 	add_assoc_zval(info, "tags", &tags);
@@ -1194,8 +3271,58 @@ static void php_pinba_get_timer_info(pinba_timer_t *t, zval *info, struct timeva
 		add_assoc_null(info, "data");
 	}
 
-	add_assoc_double(info, "ru_utime", timeval_to_float(t->ru_utime));
-	add_assoc_double(info, "ru_stime", timeval_to_float(t->ru_stime));
+	add_assoc_double(info, "ru_utime", ns_to_float(t->ru_utime));
+	add_assoc_double(info, "ru_stime", ns_to_float(t->ru_stime));
+}
+/* }}} */
+
+/* Find or create the stopped timer pinba_measure() adds to, PINBA_G(measure_timers) holds a reference to it.
+   Immutable tag arrays are remembered by address, so the same call site doesn't convert and sort them again,
+   a PinbaTagSet is looked up as is. */
+static pinba_timer_t *php_pinba_measure_timer(zval *tags_zv) /* {{{ */
+{
+	pinba_timer_t *t;
+	pinba_timer_tags_t *tags, *tags_copy;
+	zend_ulong slot;
+	zval *zslot, tmp;
+	HashTable *tags_array = Z_TYPE_P(tags_zv) == IS_ARRAY ? Z_ARRVAL_P(tags_zv) : NULL;
+	zend_bool immutable = tags_array && PINBA_ARRAY_IS_IMMUTABLE(tags_array);
+
+	if (immutable && (zslot = zend_hash_index_find(&PINBA_G(measure_literals), (zend_ulong)(uintptr_t)tags_array)) != NULL) {
+		t = zend_hash_index_find_ptr(&PINBA_G(measure_timers), Z_LVAL_P(zslot));
+		if (t && !t->deleted) {
+			return t;
+		}
+	}
+
+	if (!tags_array) {
+		tags = php_pinba_tagset_object(Z_OBJ_P(tags_zv))->tags;
+	} else if (php_pinba_array_to_tags(tags_array, &tags, NULL) != SUCCESS) {
+		return NULL;
+	}
+
+	t = php_pinba_timers_uniq_find(&PINBA_G(measure_timers), tags, &slot);
+	if (!t || t->deleted) {
+		/* first call with these tags or the previous timer has already been flushed */
+		tags_copy = (pinba_timer_tags_t *)php_pinba_timers_alloc(PINBA_TAGS_SIZE(tags->num, tags->blob_len));
+		memcpy(tags_copy, tags, PINBA_TAGS_SIZE(tags->num, tags->blob_len));
+
+		t = php_pinba_timer_ctor(tags_copy);
+		if (PINBA_G(timer_nesting)) {
+			/* the parent is the timer running around the first call */
+			php_pinba_timer_set_parent(t);
+		}
+		zend_hash_index_update_ptr(&PINBA_G(measure_timers), slot, t);
+	}
+	if (tags_array) {
+		efree(tags);
+	}
+
+	if (immutable) {
+		ZVAL_LONG(&tmp, slot);
+		zend_hash_index_update(&PINBA_G(measure_literals), (zend_ulong)(uintptr_t)tags_array, &tmp);
+	}
+	return t;
 }
 /* }}} */
 
@@ -1264,34 +3391,224 @@ zend_object *pinba_client_new(zend_class_entry *ce) /* {{{ */
 }
 /* }}} */
 
+static void *php_pinba_decode_alloc(void *allocator_data, size_t size) /* {{{ */
+{
+	return php_pinba_arena_alloc((pinba_arena *)allocator_data, size);
+}
+/* }}} */
+
+static void php_pinba_decode_free(void *allocator_data, void *ptr) /* {{{ */
+{
+	/* everything is released at once by php_pinba_arena_destroy() */
+}
+/* }}} */
+
+static inline void php_pinba_decode_add_tag(zval *tags, Pinba__Request *request, uint32_t name_id, uint32_t value_id) /* {{{ */
+{
+	const char *name = request->dictionary[name_id];
+
+	add_assoc_string_ex(tags, name, strlen(name), request->dictionary[value_id]);
+}
+/* }}} */
+
+static int php_pinba_request_to_array(Pinba__Request *request, zval *result, int depth) /* {{{ */
+{
+	zval timers, tags, dictionary, requests;
+	size_t i, j, tag_offset, hist_offset = 0, n_timers;
+	zend_bool has_hist;
+
+	if (depth > PINBA_DECODE_MAX_DEPTH) {
+		php_error_docref(NULL, E_WARNING, "too many nested requests in the packet");
+		return FAILURE;
+	}
+
+	n_timers = request->n_timer_value;
+	if (request->n_timer_hit_count != n_timers || request->n_timer_tag_count != n_timers) {
+		php_error_docref(NULL, E_WARNING, "malformed packet: timer fields count mismatch");
+		return FAILURE;
+	}
+
+	if (request->n_tag_name != request->n_tag_value || request->n_timer_tag_name != request->n_timer_tag_value) {
+		php_error_docref(NULL, E_WARNING, "malformed packet: tag name and value count mismatch");
+		return FAILURE;
+	}
+
+	for (i = 0; i < request->n_tag_name; i++) {
+		if (request->tag_name[i] >= request->n_dictionary || request->tag_value[i] >= request->n_dictionary) {
+			php_error_docref(NULL, E_WARNING, "malformed packet: request tag refers to unknown dictionary id");
+			return FAILURE;
+		}
+	}
+
+	for (i = 0; i < request->n_timer_tag_name; i++) {
+		if (request->timer_tag_name[i] >= request->n_dictionary || request->timer_tag_value[i] >= request->n_dictionary) {
+			php_error_docref(NULL, E_WARNING, "malformed packet: timer tag refers to unknown dictionary id");
+			return FAILURE;
+		}
+	}
+
+	for (i = 0, tag_offset = 0; i < n_timers; i++) {
+		tag_offset += request->timer_tag_count[i];
+	}
+
+	if (tag_offset != request->n_timer_tag_name) {
+		php_error_docref(NULL, E_WARNING, "malformed packet: timer tag count mismatch");
+		return FAILURE;
+	}
+
+	has_hist = n_timers && request->n_timer_hist_count == n_timers
+		&& request->n_timer_min_value == n_timers && request->n_timer_max_value == n_timers;
+	if (has_hist) {
+		if (request->n_timer_hist_bucket != request->n_timer_hist_hits) {
+			php_error_docref(NULL, E_WARNING, "malformed packet: timer histogram bucket and hits count mismatch");
+			return FAILURE;
+		}
+		for (i = 0, hist_offset = 0; i < n_timers; i++) {
+			hist_offset += request->timer_hist_count[i];
+		}
+		if (hist_offset != request->n_timer_hist_bucket) {
+			php_error_docref(NULL, E_WARNING, "malformed packet: timer histogram count mismatch");
+			return FAILURE;
+		}
+	}
+
+	array_init(result);
+
+	add_assoc_string(result, "hostname", request->hostname);
+	add_assoc_string(result, "server_name", request->server_name);
+	add_assoc_string(result, "script_name", request->script_name);
+	if (request->schema) {
+		add_assoc_string(result, "schema", request->schema);
+	} else {
+		add_assoc_null(result, "schema");
+	}
+	add_assoc_long(result, "request_count", request->request_count);
+	add_assoc_long(result, "document_size", request->document_size);
+	add_assoc_long(result, "memory_peak", request->memory_peak);
+	if (request->has_memory_footprint) {
+		add_assoc_long(result, "memory_footprint", request->memory_footprint);
+	} else {
+		add_assoc_null(result, "memory_footprint");
+	}
+	add_assoc_double(result, "request_time", request->request_time);
+	if (request->has_request_time_sketch) {
+		add_assoc_stringl(result, "request_time_sketch", (char *)request->request_time_sketch.data, request->request_time_sketch.len);
+	}
+	add_assoc_double(result, "ru_utime", request->ru_utime);
+	add_assoc_double(result, "ru_stime", request->ru_stime);
+	if (request->has_status) {
+		add_assoc_long(result, "status", request->status);
+	} else {
+		add_assoc_null(result, "status");
+	}
+
+	array_init_size(&dictionary, request->n_dictionary);
+	for (i = 0; i < request->n_dictionary; i++) {
+		add_next_index_string(&dictionary, request->dictionary[i]);
+	}
+	add_assoc_zval(result, "dictionary", &dictionary);
+
+	array_init(&tags);
+	for (i = 0; i < request->n_tag_name; i++) {
+		php_pinba_decode_add_tag(&tags, request, request->tag_name[i], request->tag_value[i]);
+	}
+	add_assoc_zval(result, "tags", &tags);
+
+	array_init_size(&timers, n_timers);
+	for (i = 0, tag_offset = 0, hist_offset = 0; i < n_timers; i++) {
+		zval timer, timer_tags;
+
+		array_init(&timer);
+		add_assoc_double(&timer, "value", request->timer_value[i]);
+		add_assoc_long(&timer, "hit_count", request->timer_hit_count[i]);
+		add_assoc_double(&timer, "ru_utime", (i < request->n_timer_ru_utime) ? request->timer_ru_utime[i] : 0);
+		add_assoc_double(&timer, "ru_stime", (i < request->n_timer_ru_stime) ? request->timer_ru_stime[i] : 0);
+		if (request->n_timer_parent == n_timers) {
+			if (request->timer_parent[i] > 0 && request->timer_parent[i] <= n_timers) {
+				add_assoc_long(&timer, "parent", request->timer_parent[i] - 1);
+			} else {
+				add_assoc_null(&timer, "parent");
+			}
+		}
+		if (request->n_timer_self_value == n_timers) {
+			add_assoc_double(&timer, "self_value", request->timer_self_value[i]);
+		}
+		if (has_hist) {
+			zval hist;
+
+			array_init_size(&hist, request->timer_hist_count[i]);
+			for (j = 0; j < request->timer_hist_count[i]; j++, hist_offset++) {
+				add_index_long(&hist, request->timer_hist_bucket[hist_offset], request->timer_hist_hits[hist_offset]);
+			}
+			add_assoc_zval(&timer, "histogram", &hist);
+			add_assoc_double(&timer, "min_value", request->timer_min_value[i]);
+			add_assoc_double(&timer, "max_value", request->timer_max_value[i]);
+		}
+		if (request->n_timer_sketch == n_timers) {
+			add_assoc_stringl(&timer, "sketch", (char *)request->timer_sketch[i].data, request->timer_sketch[i].len);
+		}
+		if (request->n_timer_counter == n_timers) {
+			add_assoc_long(&timer, "counter", (zend_long)request->timer_counter[i]);
+		}
+
+		array_init_size(&timer_tags, request->timer_tag_count[i]);
+		for (j = 0; j < request->timer_tag_count[i]; j++, tag_offset++) {
+			php_pinba_decode_add_tag(&timer_tags, request, request->timer_tag_name[tag_offset], request->timer_tag_value[tag_offset]);
+		}
+		add_assoc_zval(&timer, "tags", &timer_tags);
+		add_next_index_zval(&timers, &timer);
+	}
+	add_assoc_zval(result, "timers", &timers);
+
+	array_init_size(&requests, request->n_requests);
+	for (i = 0; i < request->n_requests; i++) {
+		zval sub_request;
+
+		if (php_pinba_request_to_array(request->requests[i], &sub_request, depth + 1) != SUCCESS) {
+			zval_ptr_dtor(&requests);
+			zval_ptr_dtor(result);
+			return FAILURE;
+		}
+		add_next_index_zval(&requests, &sub_request);
+	}
+	add_assoc_zval(result, "requests", &requests);
+	return SUCCESS;
+}
+/* }}} */
+
 /* }}} */
 
-/* {{{ proto resource pinba_timer_start(array tags[[, array data], int hit_count])
+/* {{{ proto PinbaTimer pinba_timer_start(array|PinbaTagSet tags[, array data[, int hit_count[, array options]]])
    Start user timer */
 static PHP_FUNCTION(pinba_timer_start)
 {
 	zval *tags_array;
 	zval *data = NULL;
 	pinba_timer_t *t = NULL;
-	pinba_timer_tag_t **tags;
+	pinba_timer_tags_t *tags;
 	int tags_num;
 	long hit_count = 1;
-	struct rusage u;
-	zend_resource *rsrc;
+	zval *options = NULL;
+	zend_bool cpu = 1;
+	pinba_cpu_sample cpu_start;
 
 	if (PINBA_G(timers_stopped)) {
 		php_error_docref(NULL, E_WARNING, "all timers have already been stopped");
 		RETURN_FALSE;
 	}
 
-	ZEND_PARSE_PARAMETERS_START(1, 3)
-		Z_PARAM_ARRAY_EX(tags_array, 0, 1)
+	ZEND_PARSE_PARAMETERS_START(1, 4)
+		Z_PARAM_ZVAL(tags_array)
 		Z_PARAM_OPTIONAL
 		Z_PARAM_ZVAL(data)
 		Z_PARAM_LONG(hit_count)
+		Z_PARAM_ARRAY_EX(options, 1, 0)
 	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
 
-	tags_num = zend_hash_num_elements(Z_ARRVAL_P(tags_array));
+	tags_num = php_pinba_tags_param(tags_array);
+	if (tags_num < 0) {
+		RETURN_FALSE;
+	}
 
 	if (!tags_num) {
 		php_error_docref(NULL, E_WARNING, "tags array cannot be empty");
@@ -1303,48 +3620,50 @@ static PHP_FUNCTION(pinba_timer_start)
 		RETURN_FALSE;
 	}
 
-	if (php_pinba_array_to_tags(Z_ARRVAL_P(tags_array), &tags) != SUCCESS) {
+	if (options && php_pinba_timer_options(Z_ARRVAL_P(options), &cpu) != SUCCESS) {
+		RETURN_FALSE;
+	}
+
+	if (php_pinba_zval_to_tags(tags_array, &tags, &PINBA_G(timers_arena)) != SUCCESS) {
 		RETURN_FALSE;
 	}
 
-	t = php_pinba_timer_ctor(tags, tags_num);
+	t = php_pinba_timer_ctor(tags);
 
-	if (data && zend_hash_num_elements(Z_ARRVAL_P(data)) > 0) {
+	if (data && Z_TYPE_P(data) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(data)) > 0) {
 		ZVAL_DUP(&t->data, data);
 	}
 
+	/* CPU time is the expensive part of a timer, hot loops can opt out of it */
+	if (cpu && php_pinba_cpu_sample(&cpu_start) == SUCCESS) {
+		t->cpu = 1;
+		t->tmp_ru_utime = cpu_start.utime;
+		t->tmp_ru_stime = cpu_start.stime;
+	}
+
 	t->started = 1;
 	t->hit_count = hit_count;
+	PINBA_TIMER_LIST_APPEND(PINBA_G(running_timers_list), t, running_link);
 
-	rsrc = zend_register_resource(t, le_pinba_timer);
-	t->rsrc_id = rsrc->handle;
-
-	if (getrusage(RUSAGE_SELF, &u) == 0) {
-		timeval_cvt(&t->tmp_ru_utime, &u.ru_utime);
-		timeval_cvt(&t->tmp_ru_stime, &u.ru_stime);
+	if (PINBA_G(timer_nesting)) {
+		php_pinba_timer_set_parent(t);
+		php_pinba_timer_stack_push(t);
 	}
-	/* refcount++ so that the timer is shut down only on request finish if not stopped manually */
-#if PHP_VERSION_ID < 70300
-	GC_REFCOUNT(rsrc)++;
-#else
-	GC_ADDREF(rsrc);
-#endif
-	RETURN_RES(rsrc);
+
+	RETURN_OBJ(PINBA_TIMER_ZOBJ(t));
 }
 /* }}} */
 
-/* {{{ proto resource pinba_timer_add(array tags, float value[[, array data,], int hit_count])
+/* {{{ proto PinbaTimer pinba_timer_add(array|PinbaTagSet tags, float value[[, array data,], int hit_count])
    Create user timer with a value */
 static PHP_FUNCTION(pinba_timer_add)
 {
 	zval *tags_array;
 	zval *data = NULL;
 	pinba_timer_t *t = NULL;
-	pinba_timer_tag_t **tags;
+	pinba_timer_tags_t *tags;
 	int tags_num;
 	double value;
-	unsigned long time_l;
-	zend_resource *rsrc;
 	long hit_count = 1;
 
 	if (PINBA_G(timers_stopped)) {
@@ -1353,14 +3672,17 @@ static PHP_FUNCTION(pinba_timer_add)
 	}
 
 	ZEND_PARSE_PARAMETERS_START(2, 4)
-		Z_PARAM_ARRAY_EX(tags_array, 0, 1)
+		Z_PARAM_ZVAL(tags_array)
 		Z_PARAM_DOUBLE(value)
 		Z_PARAM_OPTIONAL
 		Z_PARAM_ZVAL(data)
 		Z_PARAM_LONG(hit_count)
 	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
 
-	tags_num = zend_hash_num_elements(Z_ARRVAL_P(tags_array));
+	tags_num = php_pinba_tags_param(tags_array);
+	if (tags_num < 0) {
+		RETURN_FALSE;
+	}
 
 	if (!tags_num) {
 		php_error_docref(NULL, E_WARNING, "tags array cannot be empty");
@@ -1372,7 +3694,7 @@ static PHP_FUNCTION(pinba_timer_add)
 		RETURN_FALSE;
 	}
 
-	if (php_pinba_array_to_tags(Z_ARRVAL_P(tags_array), &tags) != SUCCESS) {
+	if (php_pinba_zval_to_tags(tags_array, &tags, &PINBA_G(timers_arena)) != SUCCESS) {
 		RETURN_FALSE;
 	}
 
@@ -1381,32 +3703,29 @@ static PHP_FUNCTION(pinba_timer_add)
 		value = 0;
 	}
 
-	t = php_pinba_timer_ctor(tags, tags_num);
+	t = php_pinba_timer_ctor(tags);
 
-	if (data && zend_hash_num_elements(Z_ARRVAL_P(data)) > 0) {
+	if (data && Z_TYPE_P(data) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(data)) > 0) {
 		ZVAL_DUP(&t->data, data);
 	}
 
 	t->started = 0;
 	t->hit_count = hit_count;
-	time_l = (unsigned long)(value * 1000000.0);
-	t->value.tv_sec = time_l / 1000000;
-	t->value.tv_usec = time_l % 1000000;
+	t->value = float_to_ns(value);
 
-	rsrc = zend_register_resource(t, le_pinba_timer);
-	t->rsrc_id = rsrc->handle;
+	if (PINBA_G(timer_nesting)) {
+		php_pinba_timer_set_parent(t);
+		if (t->parent) {
+			t->parent->children_value += t->value;
+		}
+	}
 
-	/* refcount++ so that the timer is shut down only on request finish if not stopped manually */
-#if PHP_VERSION_ID < 70300
-	GC_REFCOUNT(rsrc)++;
-#else
-	GC_ADDREF(rsrc);
-#endif
-	RETURN_RES(rsrc);
+	php_pinba_timer_weaken(t);
+	RETURN_OBJ(PINBA_TIMER_ZOBJ(t));
 }
 /* }}} */
 
-/* {{{ proto bool pinba_timer_stop(resource timer)
+/* {{{ proto bool pinba_timer_stop(PinbaTimer timer)
    Stop user timer */
 static PHP_FUNCTION(pinba_timer_stop)
 {
@@ -1418,7 +3737,7 @@ static PHP_FUNCTION(pinba_timer_stop)
 		RETURN_FALSE;
 	}
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "r", &timer) != SUCCESS) {
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &timer, pinba_timer_ce) != SUCCESS) {
 		return;
 	}
 
@@ -1430,18 +3749,73 @@ static PHP_FUNCTION(pinba_timer_stop)
 	}
 
 	php_pinba_timer_stop(t, NULL, NULL);
+	php_pinba_timer_weaken(t);
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool pinba_timer_restart(PinbaTimer timer)
+   Start a stopped timer again, adding one more hit and the time until the next stop to its value */
+static PHP_FUNCTION(pinba_timer_restart)
+{
+	zval *timer;
+	pinba_timer_t *t;
+	pinba_cpu_sample cpu_start;
+
+	if (PINBA_G(timers_stopped)) {
+		php_error_docref(NULL, E_WARNING, "all timers have already been stopped");
+		RETURN_FALSE;
+	}
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &timer, pinba_timer_ce) != SUCCESS) {
+		return;
+	}
+
+	PHP_ZVAL_TO_TIMER(timer, t);
+
+	if (t->started) {
+		php_error_docref(NULL, E_NOTICE, "timer is already running");
+		RETURN_FALSE;
+	}
+
+	if (t->deleted) {
+		php_error_docref(NULL, E_WARNING, "timer has been deleted or already sent");
+		RETURN_FALSE;
+	}
+
+	/* running timers are kept by the list */
+	if (t->weak) {
+		t->weak = 0;
+		PINBA_GC_ADDREF(PINBA_TIMER_ZOBJ(t));
+	}
+
+	if (t->cpu && php_pinba_cpu_sample(&cpu_start) == SUCCESS) {
+		t->tmp_ru_utime = cpu_start.utime;
+		t->tmp_ru_stime = cpu_start.stime;
+	}
+
+	t->started = 1;
+	t->hit_count++;
+	t->start = php_pinba_clock_ns();
+	PINBA_TIMER_LIST_APPEND(PINBA_G(running_timers_list), t, running_link);
+
+	/* the parent stays the one of the first run, timers started from now on are nested into this one */
+	if (PINBA_G(timer_nesting)) {
+		php_pinba_timer_stack_push(t);
+	}
+
 	RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto bool pinba_timer_delete(resource timer)
+/* {{{ proto bool pinba_timer_delete(PinbaTimer timer)
    Delete user timer */
 static PHP_FUNCTION(pinba_timer_delete)
 {
 	zval *timer;
 	pinba_timer_t *t;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "r", &timer) != SUCCESS) {
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &timer, pinba_timer_ce) != SUCCESS) {
 		return;
 	}
 
@@ -1452,12 +3826,12 @@ static PHP_FUNCTION(pinba_timer_delete)
 	}
 
 	t->deleted = 1;
-	zend_list_delete(Z_RES_P(timer));
+	php_pinba_timer_unlink(t);
 	RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto bool pinba_timer_data_merge(resource timer, array data)
+/* {{{ proto bool pinba_timer_data_merge(PinbaTimer timer, array data)
    Merge timer data with new data */
 static PHP_FUNCTION(pinba_timer_data_merge)
 {
@@ -1469,7 +3843,7 @@ static PHP_FUNCTION(pinba_timer_data_merge)
 		RETURN_FALSE;
 	}
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "ra", &timer, &data) != SUCCESS) {
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oa", &timer, pinba_timer_ce, &data) != SUCCESS) {
 		return;
 	}
 
@@ -1485,7 +3859,7 @@ static PHP_FUNCTION(pinba_timer_data_merge)
 }
 /* }}} */
 
-/* {{{ proto bool pinba_timer_data_replace(resource timer, array data)
+/* {{{ proto bool pinba_timer_data_replace(PinbaTimer timer, array data)
    Replace timer data with new one */
 static PHP_FUNCTION(pinba_timer_data_replace)
 {
@@ -1497,7 +3871,7 @@ static PHP_FUNCTION(pinba_timer_data_replace)
 		RETURN_FALSE;
 	}
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "ra!", &timer, &data) != SUCCESS) {
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oa!", &timer, pinba_timer_ce, &data) != SUCCESS) {
 		return;
 	}
 
@@ -1520,25 +3894,24 @@ static PHP_FUNCTION(pinba_timer_data_replace)
 }
 /* }}} */
 
-/* {{{ proto bool pinba_timer_tags_merge(resource timer, array tags)
+/* {{{ proto bool pinba_timer_tags_merge(PinbaTimer timer, array tags)
    Merge timer data with new data */
 static PHP_FUNCTION(pinba_timer_tags_merge)
 {
 	zval *tags;
 	zval *timer;
 	pinba_timer_t *t;
-	pinba_timer_tag_t **new_tags;
-	int i, j, tags_num;
+	pinba_timer_tags_t *new_tags, *merged_tags;
+	int tags_num;
 
 	if (PINBA_G(timers_stopped)) {
 		php_error_docref(NULL, E_WARNING, "all timers have already been stopped");
 		RETURN_FALSE;
 	}
 
-	ZEND_PARSE_PARAMETERS_START(2, 2)
-		Z_PARAM_RESOURCE(timer)
-		Z_PARAM_ARRAY_EX(tags, 0, 1)
-	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oa", &timer, pinba_timer_ce, &tags) != SUCCESS) {
+		RETURN_FALSE;
+	}
 
 	PHP_ZVAL_TO_TIMER(timer, t);
 
@@ -1548,52 +3921,27 @@ static PHP_FUNCTION(pinba_timer_tags_merge)
 		RETURN_TRUE;
 	}
 
-	if (php_pinba_array_to_tags(Z_ARRVAL_P(tags), &new_tags) != SUCCESS) {
+	if (php_pinba_array_to_tags(Z_ARRVAL_P(tags), &new_tags, NULL) != SUCCESS) {
 		RETURN_FALSE;
 	}
 
-	for (i = 0; i < tags_num; i++) {
-		int found = 0;
-		for (j = 0; j < t->tags_num; j++) {
-			if (t->tags[j]->name_len == new_tags[i]->name_len && memcmp(t->tags[j]->name, new_tags[i]->name, new_tags[i]->name_len) == 0) {
-				found = 1;
-				break;
-			}
-		}
-		if (found == 1) {
-			/* replace */
-			efree(t->tags[j]->value);
-			t->tags[j]->value = estrndup(new_tags[i]->value, new_tags[i]->value_len);
-			t->tags[j]->value_len = new_tags[i]->value_len;
-		} else {
-			/* add */
-			pinba_timer_tag_t *tag;
-
-			t->tags = (pinba_timer_tag_t **)erealloc(t->tags, (t->tags_num + 1) * sizeof(pinba_timer_tag_t *));
-			tag = (pinba_timer_tag_t *)emalloc(sizeof(pinba_timer_tag_t));
-			tag->value = estrndup(new_tags[i]->value, new_tags[i]->value_len);
-			tag->value_len = new_tags[i]->value_len;
-			tag->name = estrndup(new_tags[i]->name, new_tags[i]->name_len);
-			tag->name_len = new_tags[i]->name_len;
-			t->tags[t->tags_num] = tag;
-			t->tags_num++;
-		}
-	}
+	merged_tags = php_pinba_tags_merge(t->tags, new_tags);
+	php_pinba_timers_free(t->tags);
+	t->tags = merged_tags;
 
-	php_pinba_timer_tags_dtor(new_tags, tags_num);
 	efree(new_tags);
 	RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto bool pinba_timer_tags_replace(resource timer, array tags)
+/* {{{ proto bool pinba_timer_tags_replace(PinbaTimer timer, array tags)
    Replace timer data with new one */
 static PHP_FUNCTION(pinba_timer_tags_replace)
 {
 	zval *tags;
 	zval *timer;
 	pinba_timer_t *t;
-	pinba_timer_tag_t **new_tags;
+	pinba_timer_tags_t *new_tags;
 	int tags_num;
 
 	if (PINBA_G(timers_stopped)) {
@@ -1601,10 +3949,9 @@ static PHP_FUNCTION(pinba_timer_tags_replace)
 		RETURN_FALSE;
 	}
 
-	ZEND_PARSE_PARAMETERS_START(2, 2)
-		Z_PARAM_RESOURCE(timer)
-		Z_PARAM_ARRAY_EX(tags, 0, 1)
-	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "Oa", &timer, pinba_timer_ce, &tags) != SUCCESS) {
+		RETURN_FALSE;
+	}
 
 	PHP_ZVAL_TO_TIMER(timer, t);
 
@@ -1615,14 +3962,12 @@ static PHP_FUNCTION(pinba_timer_tags_replace)
 		RETURN_TRUE;
 	}
 
-	if (php_pinba_array_to_tags(Z_ARRVAL_P(tags), &new_tags) != SUCCESS) {
+	if (php_pinba_array_to_tags(Z_ARRVAL_P(tags), &new_tags, &PINBA_G(timers_arena)) != SUCCESS) {
 		RETURN_FALSE;
 	}
 
-	php_pinba_timer_tags_dtor(t->tags, t->tags_num);
-	efree(t->tags);
+	php_pinba_timers_free(t->tags);
 	t->tags = new_tags;
-	t->tags_num = tags_num;
 
 	RETURN_TRUE;
 }
@@ -1664,6 +4009,7 @@ static PHP_FUNCTION(pinba_get_info)
 {
 	zval timers, timer_info, tags;
 	struct timeval tmp;
+	int64_t now;
 	struct rusage u;
 	HashPosition pos;
 	zval *zv;
@@ -1681,15 +4027,10 @@ static PHP_FUNCTION(pinba_get_info)
 		/* use custom request time */
 		add_assoc_double(return_value, "req_time", PINBA_G(request_time));
 	} else {
-		if (gettimeofday(&tmp, 0) == 0) {
-			timersub(&tmp, &(PINBA_G(tmp_req_data).req_start), &tmp);
-			add_assoc_double(return_value, "req_time", timeval_to_float(tmp));
-		} else {
-			add_assoc_double(return_value, "req_time", 0);
-		}
+		add_assoc_double(return_value, "req_time", ns_to_float(php_pinba_clock_ns() - PINBA_G(tmp_req_data).req_start));
 	}
 
-	if (getrusage(RUSAGE_SELF, &u) == 0) {
+	if (getrusage(PINBA_RUSAGE_WHO, &u) == 0) {
 		timersub(&u.ru_utime, &(PINBA_G(tmp_req_data).ru_utime), &tmp);
 		add_assoc_double(return_value, "ru_utime", timeval_to_float(tmp));
 		timersub(&u.ru_stime, &(PINBA_G(tmp_req_data).ru_stime), &tmp);
@@ -1723,23 +4064,20 @@ static PHP_FUNCTION(pinba_get_info)
 	add_assoc_string(return_value, "hostname", PINBA_G(host_name));
 
 	array_init(&timers);
-	gettimeofday(&tmp, 0);
-
-	for (zend_hash_internal_pointer_reset_ex(&EG(regular_list), &pos);
-			(zv = zend_hash_get_current_data_ex((&EG(regular_list)), &pos)) != NULL;
-			zend_hash_move_forward_ex(&EG(regular_list), &pos)) {
-		zend_resource *rsrc = Z_RES_P(zv);
-		if (rsrc->type == le_pinba_timer) {
-			t = (pinba_timer_t *)rsrc->ptr;
-
-			if (t->deleted) {
-				continue;
-			}
+	now = php_pinba_clock_ns();
 
-			php_pinba_get_timer_info(t, &timer_info, &tmp);
-			add_next_index_zval(&timers, &timer_info);
+	for (t = PINBA_G(timers_list).first; t; t = t->link.next) {
+		if (t->deleted) {
+			continue;
 		}
+
+		php_pinba_get_timer_info(t, &timer_info, &now);
+		add_next_index_zval(&timers, &timer_info);
 	}
+	ZEND_HASH_FOREACH_PTR(&PINBA_G(timers_folded), t) {
+		php_pinba_get_timer_info(t, &timer_info, &now);
+		add_next_index_zval(&timers, &timer_info);
+	} ZEND_HASH_FOREACH_END();
 	add_assoc_zval(return_value, "timers", &timers);
 
 	array_init(&tags);
@@ -1774,7 +4112,9 @@ static PHP_FUNCTION(pinba_get_data)
 		return;
 	}
 
+	php_pinba_timers_snapshot(flags, 1);
 	request = php_create_pinba_packet(NULL, NULL, flags);
+	php_pinba_timers_snapshot(flags, 0);
 	if (!request) {
 		RETURN_FALSE;
 	}
@@ -1786,14 +4126,53 @@ static PHP_FUNCTION(pinba_get_data)
 }
 /* }}} */
 
-/* {{{ proto array pinba_timer_get_info(resource timer)
+/* {{{ proto array pinba_decode(string packet)
+   Decode Pinba packet into an array */
+static PHP_FUNCTION(pinba_decode)
+{
+	Pinba__Request *request;
+	ProtobufCAllocator allocator;
+	pinba_arena arena;
+	char *packet;
+	size_t packet_len;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "s", &packet, &packet_len) != SUCCESS) {
+		return;
+	}
+
+	allocator.alloc = php_pinba_decode_alloc;
+	allocator.free = php_pinba_decode_free;
+	allocator.tmp_alloc = php_pinba_decode_alloc;
+	allocator.max_alloca = PINBA_DECODE_CHUNK_SIZE;
+	allocator.allocator_data = &arena;
+
+	php_pinba_arena_init(&arena, PINBA_DECODE_CHUNK_SIZE, 0);
+
+	request = pinba__request__unpack(&allocator, packet_len, (const uint8_t *)packet);
+	if (!request) {
+		php_pinba_arena_destroy(&arena);
+		php_error_docref(NULL, E_WARNING, "failed to decode Pinba packet");
+		RETURN_FALSE;
+	}
+
+	if (php_pinba_request_to_array(request, return_value, 0) != SUCCESS) {
+		php_pinba_arena_destroy(&arena);
+		RETURN_FALSE;
+	}
+
+	/* the request lives in the arena, so there's nothing to free one by one */
+	php_pinba_arena_destroy(&arena);
+}
+/* }}} */
+
+/* {{{ proto array pinba_timer_get_info(PinbaTimer timer)
    Get timer data */
 static PHP_FUNCTION(pinba_timer_get_info)
 {
 	zval *timer;
 	pinba_timer_t *t;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "r", &timer) != SUCCESS) {
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &timer, pinba_timer_ce) != SUCCESS) {
 		return;
 	}
 
@@ -1803,72 +4182,421 @@ static PHP_FUNCTION(pinba_timer_get_info)
 }
 /* }}} */
 
+/* one entry of a timers batch: array(tags, value[, hit_count[, rusage]]) */
+typedef struct _pinba_batch_timer { /* {{{ */
+	zval *tags;
+	double value;
+	zend_long hit_count;
+	double ru_utime;
+	double ru_stime;
+} pinba_batch_timer;
+/* }}} */
+
+/* numbers and numeric strings only, like the arguments of pinba_timer_add(); returns IS_LONG, IS_DOUBLE or 0 */
+static zend_uchar php_pinba_batch_number(zval *zv, zend_long *lval, double *dval) /* {{{ */
+{
+	zend_uchar type;
+
+	switch (Z_TYPE_P(zv)) {
+		case IS_LONG:
+			*lval = Z_LVAL_P(zv);
+			*dval = (double)*lval;
+			return IS_LONG;
+		case IS_DOUBLE:
+			*dval = Z_DVAL_P(zv);
+			return IS_DOUBLE;
+		case IS_STRING:
+			type = is_numeric_string(Z_STRVAL_P(zv), Z_STRLEN_P(zv), lval, dval, 0);
+			if (type == IS_LONG) {
+				*dval = (double)*lval;
+			}
+			return type;
+	}
+	return 0;
+}
+/* }}} */
+
+static int php_pinba_batch_timer_parse(zval *entry, int n, pinba_batch_timer *bt) /* {{{ */
+{
+	HashTable *ht;
+	zval *value, *tmp;
+	zend_long lval;
+	double dval;
+	int tags_num, i = 0;
+
+	if (Z_TYPE_P(entry) != IS_ARRAY) {
+		php_error_docref(NULL, E_WARNING, "batch entry #%d must be an array", n);
+		return FAILURE;
+	}
+	ht = Z_ARRVAL_P(entry);
+
+	bt->tags = zend_hash_index_find(ht, 0);
+	value = zend_hash_index_find(ht, 1);
+	if (!bt->tags || !value) {
+		php_error_docref(NULL, E_WARNING, "batch entry #%d must contain tags and value", n);
+		return FAILURE;
+	}
+
+	tags_num = php_pinba_tags_param(bt->tags);
+	if (tags_num < 0) {
+		return FAILURE;
+	}
+	if (!tags_num) {
+		php_error_docref(NULL, E_WARNING, "batch entry #%d: tags array cannot be empty", n);
+		return FAILURE;
+	}
+
+	ZVAL_DEREF(value);
+	if (!php_pinba_batch_number(value, &lval, &bt->value)) {
+		php_error_docref(NULL, E_WARNING, "batch entry #%d: timer value must be a number", n);
+		return FAILURE;
+	}
+	if (bt->value < 0) {
+		php_error_docref(NULL, E_WARNING, "batch entry #%d: timer value cannot be less than 0", n);
+		return FAILURE;
+	}
+
+	bt->hit_count = 1;
+	tmp = zend_hash_index_find(ht, 2);
+	if (tmp) {
+		ZVAL_DEREF(tmp);
+		if (php_pinba_batch_number(tmp, &bt->hit_count, &dval) != IS_LONG) {
+			php_error_docref(NULL, E_WARNING, "batch entry #%d: timer hit count must be an integer", n);
+			return FAILURE;
+		}
+		if (bt->hit_count <= 0) {
+			php_error_docref(NULL, E_WARNING, "batch entry #%d: timer hit count must be greater than 0 (%ld was passed)", n, (long)bt->hit_count);
+			return FAILURE;
+		}
+	}
+
+	bt->ru_utime = bt->ru_stime = 0;
+	tmp = zend_hash_index_find(ht, 3);
+	if (tmp && Z_TYPE_P(tmp) != IS_NULL) {
+		if (Z_TYPE_P(tmp) != IS_ARRAY || zend_hash_num_elements(Z_ARRVAL_P(tmp)) != 2) {
+			php_error_docref(NULL, E_WARNING, "batch entry #%d: rusage array must contain exactly 2 elements", n);
+			return FAILURE;
+		}
+		ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(tmp), value) {
+			ZVAL_DEREF(value);
+			if (!php_pinba_batch_number(value, &lval, i++ == 0 ? &bt->ru_utime : &bt->ru_stime)) {
+				php_error_docref(NULL, E_WARNING, "batch entry #%d: rusage values must be numbers", n);
+				return FAILURE;
+			}
+		} ZEND_HASH_FOREACH_END();
+	}
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ proto bool pinba_timers_add(array batch)
+   Add timers measured elsewhere, each entry is array(tags, value[, hit_count[, rusage]]).
+   The timers are summed up by tags right away, no PinbaTimer objects are created. */
+static PHP_FUNCTION(pinba_timers_add)
+{
+	zval *batch, *entry;
+	pinba_batch_timer bt;
+	pinba_timer_t tmp;
+	int n = 0;
+	zend_bool all_added = 1;
+
+	if (PINBA_G(timers_stopped)) {
+		php_error_docref(NULL, E_WARNING, "all timers have already been stopped");
+		RETURN_FALSE;
+	}
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_ARRAY(batch)
+	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
+
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(batch), entry) {
+		ZVAL_DEREF(entry);
+		if (php_pinba_batch_timer_parse(entry, n++, &bt) != SUCCESS) {
+			all_added = 0;
+			continue;
+		}
+
+		/* a stopped timer dropped by the script is folded the same way */
+		memset(&tmp, 0, sizeof(tmp));
+		if (Z_TYPE_P(bt.tags) == IS_OBJECT) {
+			tmp.tags = php_pinba_tagset_object(Z_OBJ_P(bt.tags))->tags;
+		} else if (php_pinba_array_to_tags(Z_ARRVAL_P(bt.tags), &tmp.tags, NULL) != SUCCESS) {
+			all_added = 0;
+			continue;
+		}
+		tmp.value = float_to_ns(bt.value);
+		tmp.ru_utime = float_to_ns(bt.ru_utime);
+		tmp.ru_stime = float_to_ns(bt.ru_stime);
+		tmp.hit_count = bt.hit_count;
+		php_pinba_timer_fold(&tmp, NULL);
+
+		if (Z_TYPE_P(bt.tags) != IS_OBJECT) {
+			efree(tmp.tags);
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	RETURN_BOOL(all_added);
+}
+/* }}} */
+
 /* {{{ proto bool pinba_timers_stop()
    Stop all timers */
 static PHP_FUNCTION(pinba_timers_stop)
 {
-	zval *zv;
-	pinba_timer_t *t;
-	HashPosition pos;
-	struct timeval now;
-	struct rusage u;
+	pinba_timer_t *t, *next;
+	int64_t now;
+	pinba_cpu_sample cpu, *pcpu;
 
 	if (zend_parse_parameters(ZEND_NUM_ARGS(), "") != SUCCESS) {
 		return;
 	}
 
-	if (gettimeofday(&now, 0) != 0 || getrusage(RUSAGE_SELF, &u) != 0) {
+	now = php_pinba_clock_ns();
+	pcpu = php_pinba_cpu_sample(&cpu) == SUCCESS ? &cpu : NULL;
+
+	/* stopping a timer removes it from the list */
+	for (t = PINBA_G(running_timers_list).first; t; t = next) {
+		next = t->running_link.next;
+		php_pinba_timer_stop(t, &now, pcpu);
+		php_pinba_timer_weaken(t);
+	}
+	RETURN_TRUE;
+}
+/* }}} */
+
+/* {{{ proto bool pinba_timers_get()
+   Get timers */
+static PHP_FUNCTION(pinba_timers_get)
+{
+	pinba_timer_t *t;
+	long flag = 0;
+
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|l", &flag) != SUCCESS) {
+		return;
+	}
+
+	array_init(return_value);
+	for (t = PINBA_G(timers_list).first; t; t = t->link.next) {
+		zval timer;
+
+		if (t->deleted || ((flag & PINBA_FLUSH_ONLY_STOPPED_TIMERS) != 0 && t->started)) {
+			continue;
+		}
+		ZVAL_OBJ(&timer, PINBA_TIMER_ZOBJ(t));
+		Z_ADDREF(timer);
+		add_next_index_zval(return_value, &timer);
+	}
+	return;
+}
+/* }}} */
+
+/* {{{ proto mixed pinba_measure(array|PinbaTagSet tags, callable fn[, mixed ...args])
+   Call fn with args and add the time it took to the timer with these tags, also if fn throws */
+static PHP_FUNCTION(pinba_measure)
+{
+	zval *tags_array;
+	zend_fcall_info fci;
+	zend_fcall_info_cache fcc;
+	pinba_timer_t *t;
+	pinba_cpu_sample cpu_start, cpu_end;
+	zend_bool cpu;
+	int64_t start, value;
+	int tags_num;
+
+	ZEND_PARSE_PARAMETERS_START(2, -1)
+		Z_PARAM_ZVAL(tags_array)
+		Z_PARAM_FUNC(fci, fcc)
+		Z_PARAM_VARIADIC('*', fci.params, fci.param_count)
+	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
+
+	tags_num = php_pinba_tags_param(tags_array);
+	if (tags_num < 0) {
+		RETURN_FALSE;
+	}
+
+	if (!tags_num) {
+		php_error_docref(NULL, E_WARNING, "tags array cannot be empty");
+		RETURN_FALSE;
+	}
+
+	fci.retval = return_value;
+
+	cpu = php_pinba_cpu_sample(&cpu_start) == SUCCESS;
+	start = php_pinba_clock_ns();
+
+	zend_call_function(&fci, &fcc);
+
+	/* the time is recorded even if fn has thrown, the exception goes on to the caller */
+	value = php_pinba_clock_ns() - start;
+	if (cpu) {
+		cpu = php_pinba_cpu_sample(&cpu_end) == SUCCESS;
+	}
+
+	if (PINBA_G(timers_stopped)) {
+		return;
+	}
+
+	t = php_pinba_measure_timer(tags_array);
+	if (!t) {
+		return;
+	}
+
+	/* the timer keeps the parent of its first call, later calls are subtracted from that one
+	   while it runs, so that self times add up along the reported hierarchy */
+	if (t->parent && t->parent->started) {
+		t->parent->children_value += value;
+	}
+
+	t->value += value;
+	t->hit_count++;
+	if (PINBA_G(timer_histograms)) {
+		if (!t->hist) {
+			t->hist = php_pinba_timers_calloc(sizeof(pinba_histogram));
+		}
+		php_pinba_histogram_add(t->hist, value, 1);
+	}
+	if (PINBA_G(sketches)) {
+		if (!t->sketch) {
+			t->sketch = emalloc(sizeof(pinba_sketch));
+			pinba_sketch_init(t->sketch, PINBA_SKETCH_DEFAULT_ALPHA);
+		}
+		pinba_sketch_add(t->sketch, ns_to_float(value), 1);
+	}
+	if (cpu) {
+		t->cpu = 1;
+		t->ru_utime += cpu_end.utime - cpu_start.utime;
+		t->ru_stime += cpu_end.stime - cpu_start.stime;
+	}
+}
+/* }}} */
+
+/* {{{ proto PinbaTagSet pinba_tagset_create(array tags)
+   Convert tags once, the set can be passed instead of the tags array to the timer functions */
+static PHP_FUNCTION(pinba_tagset_create)
+{
+	HashTable *tags_array;
+	pinba_timer_tags_t *tags;
+	zend_object *obj;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_ARRAY_HT(tags_array)
+	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
+
+	if (!zend_hash_num_elements(tags_array)) {
+		php_error_docref(NULL, E_WARNING, "tags array cannot be empty");
+		RETURN_FALSE;
+	}
+
+	if (php_pinba_array_to_tags(tags_array, &tags, NULL) != SUCCESS) {
+		RETURN_FALSE;
+	}
+
+	obj = pinba_tagset_new(pinba_tagset_ce);
+	php_pinba_tagset_object(obj)->tags = tags;
+	RETURN_OBJ(obj);
+}
+/* }}} */
+
+/* {{{ proto array pinba_tagset_get_tags(PinbaTagSet tagset)
+   Return the tags of the set sorted by name */
+static PHP_FUNCTION(pinba_tagset_get_tags)
+{
+	zval *tagset;
+	pinba_timer_tags_t *tags;
+	int i;
+
+	if (zend_parse_method_parameters(ZEND_NUM_ARGS(), getThis(), "O", &tagset, pinba_tagset_ce) != SUCCESS) {
+		return;
+	}
+
+	tags = php_pinba_tagset_object(Z_OBJ_P(tagset))->tags;
+	array_init_size(return_value, tags->num);
+	for (i = 0; i < tags->num; i++) {
+		add_assoc_stringl_ex(return_value, PINBA_TAG_NAME(tags, i), tags->tag[i].name_len, PINBA_TAG_VALUE(tags, i), tags->tag[i].value_len);
+	}
+}
+/* }}} */
+
+static int php_pinba_sketch_from_zval(zval *data, pinba_sketch *sketch, uint32_t arg_num) /* {{{ */
+{
+	if (Z_TYPE_P(data) != IS_STRING) {
+		php_error_docref(NULL, E_WARNING, "argument #%d must be a string, %s given", arg_num, zend_zval_type_name(data));
+		return FAILURE;
+	}
+	if (pinba_sketch_unserialize(sketch, (const uint8_t *)Z_STRVAL_P(data), Z_STRLEN_P(data)) != 0) {
+		php_error_docref(NULL, E_WARNING, "argument #%d is not a valid sketch", arg_num);
+		return FAILURE;
+	}
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ proto string pinba_sketch_merge(string sketch, string ...sketches)
+   Merge serialized quantile sketches (e.g. timer "sketch" values from pinba_decode()) into one */
+static PHP_FUNCTION(pinba_sketch_merge)
+{
+	zval *args;
+	int argc, i;
+	pinba_sketch total, sketch;
+	zend_string *result;
+
+	ZEND_PARSE_PARAMETERS_START(1, -1)
+		Z_PARAM_VARIADIC('+', args, argc)
+	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
+
+	if (php_pinba_sketch_from_zval(&args[0], &total, 1) != SUCCESS) {
 		RETURN_FALSE;
 	}
 
-	for (zend_hash_internal_pointer_reset_ex(&EG(regular_list), &pos);
-			(zv = zend_hash_get_current_data_ex((&EG(regular_list)), &pos)) != NULL;
-			zend_hash_move_forward_ex(&EG(regular_list), &pos)) {
-		zend_resource *rsrc = Z_RES_P(zv);
-
-		if (rsrc->type == le_pinba_timer) {
-			t = (pinba_timer_t *)rsrc->ptr;
-			php_pinba_timer_stop(t, &now, &u);
+	for (i = 1; i < argc; i++) {
+		if (php_pinba_sketch_from_zval(&args[i], &sketch, i + 1) != SUCCESS) {
+			pinba_sketch_destroy(&total);
+			RETURN_FALSE;
+		}
+		if (pinba_sketch_merge(&total, &sketch) != 0) {
+			if (total.alpha != sketch.alpha) {
+				php_error_docref(NULL, E_WARNING, "argument #%d has a different relative accuracy (%g, expected %g)", i + 1, sketch.alpha, total.alpha);
+			} else {
+				php_error_docref(NULL, E_WARNING, "failed to allocate memory for the sketch");
+			}
+			pinba_sketch_destroy(&sketch);
+			pinba_sketch_destroy(&total);
+			RETURN_FALSE;
 		}
+		pinba_sketch_destroy(&sketch);
 	}
-	RETURN_TRUE;
+
+	result = zend_string_alloc(pinba_sketch_serialized_size(&total), 0);
+	ZSTR_LEN(result) = pinba_sketch_serialize(&total, (uint8_t *)ZSTR_VAL(result));
+	ZSTR_VAL(result)[ZSTR_LEN(result)] = '\0';
+	pinba_sketch_destroy(&total);
+	RETURN_NEW_STR(result);
 }
 /* }}} */
 
-/* {{{ proto bool pinba_timers_get()
-   Get timers */
-static PHP_FUNCTION(pinba_timers_get)
+/* {{{ proto float pinba_sketch_quantile(string sketch, float q)
+   Return the q-quantile (0 <= q <= 1) of a serialized quantile sketch */
+static PHP_FUNCTION(pinba_sketch_quantile)
 {
-	zval *zv;
-	HashPosition pos;
-	pinba_timer_t *t;
-	long flag = 0;
+	zval *data;
+	double q;
+	pinba_sketch sketch;
 
-	if (zend_parse_parameters(ZEND_NUM_ARGS(), "|l", &flag) != SUCCESS) {
+	if (zend_parse_parameters(ZEND_NUM_ARGS(), "zd", &data, &q) != SUCCESS) {
 		return;
 	}
 
-	array_init(return_value);
-	for (zend_hash_internal_pointer_reset_ex(&EG(regular_list), &pos);
-			(zv = zend_hash_get_current_data_ex((&EG(regular_list)), &pos)) != NULL;
-			zend_hash_move_forward_ex(&EG(regular_list), &pos)) {
-		zend_resource *rsrc = Z_RES_P(zv);
-
-		if (rsrc->type == le_pinba_timer) {
-			t = (pinba_timer_t *)rsrc->ptr;
-			if (t->deleted || ((flag & PINBA_FLUSH_ONLY_STOPPED_TIMERS) != 0 && t->started)) {
-				continue;
-			}
-			/* refcount++ */
-#if PHP_VERSION_ID < 70300
-			GC_REFCOUNT(rsrc)++;
-#else
-			GC_ADDREF(rsrc);
-#endif
-			add_next_index_resource(return_value, rsrc);
-		}
+	if (!(q >= 0 && q <= 1)) {
+		php_error_docref(NULL, E_WARNING, "quantile must be between 0 and 1");
+		RETURN_FALSE;
 	}
-	return;
+
+	if (php_pinba_sketch_from_zval(data, &sketch, 1) != SUCCESS) {
+		RETURN_FALSE;
+	}
+
+	RETVAL_DOUBLE(pinba_sketch_quantile(&sketch, q));
+	pinba_sketch_destroy(&sketch);
 }
 /* }}} */
 
@@ -2211,20 +4939,62 @@ static PHP_METHOD(PinbaClient, setTag)
 }
 /* }}} */
 
+static int php_pinba_client_timer_put(pinba_client_t *client, zval *tags, double value, zend_long hit_count, double ru_utime, double ru_stime, int add) /* {{{ */
+{
+	pinba_timer_t *timer;
+	pinba_timer_tags_t *new_tags;
+	zend_ulong slot;
+
+	if (php_pinba_zval_to_tags(tags, &new_tags, NULL) != SUCCESS) {
+		return FAILURE;
+	}
+
+	timer = ecalloc(1, sizeof(pinba_timer_t));
+	timer->packet_index = -1;
+	timer->value = float_to_ns(value);
+	timer->ru_utime = float_to_ns(ru_utime);
+	timer->ru_stime = float_to_ns(ru_stime);
+	timer->tags = new_tags;
+	timer->hit_count = hit_count;
+
+	if (add) {
+		pinba_timer_t *old_t;
+
+		old_t = php_pinba_timers_uniq_find(&client->timers, new_tags, &slot);
+		if (old_t != NULL) {
+			old_t->value += timer->value;
+			old_t->ru_utime += timer->ru_utime;
+			old_t->ru_stime += timer->ru_stime;
+			if (timer->hit_count) {
+				old_t->hit_count += timer->hit_count;
+			} else {
+				old_t->hit_count++;
+			}
+			php_pinba_timer_dtor(timer);
+			efree(timer);
+		} else {
+			zend_hash_index_add_ptr(&client->timers, slot, timer);
+		}
+	} else {
+		php_pinba_timers_uniq_find(&client->timers, new_tags, &slot);
+		zend_hash_index_update_ptr(&client->timers, slot, timer);
+	}
+	return SUCCESS;
+}
+/* }}} */
+
 static void php_pinba_client_timer_add_set(INTERNAL_FUNCTION_PARAMETERS, int add) /* {{{ */
 {
 	pinba_client_t *client;
 	long hit_count = 1;
 	double value, ru_utime = 0, ru_stime = 0;
 	zval *tags, *rusage = NULL;
-	char *hashed_tags;
-	size_t hashed_tags_len, i, tags_num;
+	size_t i;
+	int tags_num;
 	zval *tmp;
-	pinba_timer_t *timer;
-	pinba_timer_tag_t **new_tags;
 
 	ZEND_PARSE_PARAMETERS_START(2, 4)
-		Z_PARAM_ARRAY_EX(tags, 0, 1)
+		Z_PARAM_ZVAL(tags)
 		Z_PARAM_DOUBLE(value)
 		Z_PARAM_OPTIONAL
 		Z_PARAM_ARRAY_EX(rusage, 0, 1)
@@ -2233,7 +5003,10 @@ static void php_pinba_client_timer_add_set(INTERNAL_FUNCTION_PARAMETERS, int add
 
 	client = Z_PINBACLIENT_P(getThis());
 
-	tags_num = zend_hash_num_elements(Z_ARRVAL_P(tags));
+	tags_num = php_pinba_tags_param(tags);
+	if (tags_num < 0) {
+		RETURN_FALSE;
+	}
 	if (!tags_num) {
 		php_error_docref(NULL, E_WARNING, "timer tags array cannot be empty");
 		RETURN_FALSE;
@@ -2267,51 +5040,14 @@ static void php_pinba_client_timer_add_set(INTERNAL_FUNCTION_PARAMETERS, int add
 		}
 	}
 
-	if (php_pinba_array_to_tags(Z_ARRVAL_P(tags), &new_tags) != SUCCESS) {
-		RETURN_FALSE;
-	}
-
-	if (php_pinba_tags_to_hashed_string(new_tags, tags_num, &hashed_tags, &hashed_tags_len) != SUCCESS) {
-		php_pinba_timer_tags_dtor(new_tags, tags_num);
-		efree(new_tags);
+	if (php_pinba_client_timer_put(client, tags, value, hit_count, ru_utime, ru_stime, add) != SUCCESS) {
 		RETURN_FALSE;
 	}
-
-	timer = ecalloc(1, sizeof(pinba_timer_t));
-	float_to_timeval(value, timer->value);
-	float_to_timeval(ru_utime, timer->ru_utime);
-	float_to_timeval(ru_stime, timer->ru_stime);
-	timer->tags = new_tags;
-	timer->tags_num = tags_num;
-	timer->hit_count = hit_count;
-
-	if (add) {
-		pinba_timer_t *old_t;
-
-		old_t = zend_hash_str_find_ptr(&client->timers, hashed_tags, hashed_tags_len);
-		if (old_t != NULL) {
-			timeradd(&old_t->value, &timer->value, &old_t->value);
-			timeradd(&old_t->ru_utime, &timer->ru_utime, &old_t->ru_utime);
-			timeradd(&old_t->ru_stime, &timer->ru_stime, &old_t->ru_stime);
-			if (timer->hit_count) {
-				old_t->hit_count += timer->hit_count;
-			} else {
-				old_t->hit_count++;
-			}
-			php_pinba_timer_dtor(timer);
-			efree(timer);
-		} else {
-			zend_hash_str_add_ptr(&client->timers, hashed_tags, hashed_tags_len, timer);
-		}
-	} else {
-		zend_hash_str_update_ptr(&client->timers, hashed_tags, hashed_tags_len, timer);
-	}
-	efree(hashed_tags);
 	RETURN_TRUE;
 }
 /* }}} */
 
-/* {{{ proto bool PinbaClient::setTimer(array tags, float value[, array rusage[, int hit_count]])
+/* {{{ proto bool PinbaClient::setTimer(array|PinbaTagSet tags, float value[, array rusage[, int hit_count]])
     */
 static PHP_METHOD(PinbaClient, setTimer)
 {
@@ -2319,7 +5055,7 @@ static PHP_METHOD(PinbaClient, setTimer)
 }
 /* }}} */
 
-/* {{{ proto bool PinbaClient::addTimer(array tags, float value[, array rusage[, int hit_count]])
+/* {{{ proto bool PinbaClient::addTimer(array|PinbaTagSet tags, float value[, array rusage[, int hit_count]])
     */
 static PHP_METHOD(PinbaClient, addTimer)
 {
@@ -2327,6 +5063,34 @@ static PHP_METHOD(PinbaClient, addTimer)
 }
 /* }}} */
 
+/* {{{ proto bool PinbaClient::addTimers(array batch)
+   Add a batch of timers, each entry is array(tags, value[, hit_count[, rusage]]) */
+static PHP_METHOD(PinbaClient, addTimers)
+{
+	pinba_client_t *client;
+	zval *batch, *entry;
+	pinba_batch_timer bt;
+	int n = 0;
+	zend_bool all_added = 1;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_ARRAY(batch)
+	ZEND_PARSE_PARAMETERS_END_EX(RETURN_FALSE);
+
+	client = Z_PINBACLIENT_P(getThis());
+
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(batch), entry) {
+		ZVAL_DEREF(entry);
+		if (php_pinba_batch_timer_parse(entry, n++, &bt) != SUCCESS
+				|| php_pinba_client_timer_put(client, bt.tags, bt.value, bt.hit_count, bt.ru_utime, bt.ru_stime, 1) != SUCCESS) {
+			all_added = 0;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	RETURN_BOOL(all_added);
+}
+/* }}} */
+
 /* {{{ proto bool PinbaClient::send([int flags])
     */
 static PHP_METHOD(PinbaClient, send)
@@ -2394,39 +5158,45 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_start, 0, 0, 1)
 	ZEND_ARG_INFO(0, tags)
 	ZEND_ARG_INFO(0, data)
 	ZEND_ARG_INFO(0, hit_count)
+	ZEND_ARG_INFO(0, options)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_add, 0, 0, 2)
 	ZEND_ARG_INFO(0, tags)
 	ZEND_ARG_INFO(0, value)
 	ZEND_ARG_INFO(0, data)
+	ZEND_ARG_INFO(0, hit_count)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_stop, 0, 0, 1)
-	ZEND_ARG_INFO(0, timer)
+	ZEND_ARG_OBJ_INFO(0, timer, PinbaTimer, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_restart, 0, 0, 1)
+	ZEND_ARG_OBJ_INFO(0, timer, PinbaTimer, 0)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_delete, 0, 0, 1)
-	ZEND_ARG_INFO(0, timer)
+	ZEND_ARG_OBJ_INFO(0, timer, PinbaTimer, 0)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_data_merge, 0, 0, 2)
-	ZEND_ARG_INFO(0, timer)
+	ZEND_ARG_OBJ_INFO(0, timer, PinbaTimer, 0)
 	ZEND_ARG_INFO(0, data)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_data_replace, 0, 0, 2)
-	ZEND_ARG_INFO(0, timer)
+	ZEND_ARG_OBJ_INFO(0, timer, PinbaTimer, 0)
 	ZEND_ARG_INFO(0, data)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_tags_merge, 0, 0, 2)
-	ZEND_ARG_INFO(0, timer)
+	ZEND_ARG_OBJ_INFO(0, timer, PinbaTimer, 0)
 	ZEND_ARG_INFO(0, tags)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_tags_replace, 0, 0, 2)
-	ZEND_ARG_INFO(0, timer)
+	ZEND_ARG_OBJ_INFO(0, timer, PinbaTimer, 0)
 	ZEND_ARG_INFO(0, tags)
 ZEND_END_ARG_INFO()
 
@@ -2445,8 +5215,16 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_get_data, 0, 0, 0)
 	ZEND_ARG_INFO(0, flags)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_decode, 0, 0, 1)
+	ZEND_ARG_INFO(0, packet)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timer_get_info, 0, 0, 1)
-	ZEND_ARG_INFO(0, timer)
+	ZEND_ARG_OBJ_INFO(0, timer, PinbaTimer, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timers_add, 0, 0, 1)
+	ZEND_ARG_INFO(0, batch)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timers_stop, 0, 0, 0)
@@ -2455,6 +5233,30 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_timers_get, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_measure, 0, 0, 2)
+	ZEND_ARG_INFO(0, tags)
+	ZEND_ARG_INFO(0, fn)
+	ZEND_ARG_VARIADIC_INFO(0, args)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_tagset_create, 0, 0, 1)
+	ZEND_ARG_INFO(0, tags)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_tagset_get_tags, 0, 0, 1)
+	ZEND_ARG_OBJ_INFO(0, tagset, PinbaTagSet, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_sketch_merge, 0, 0, 1)
+	ZEND_ARG_INFO(0, sketch)
+	ZEND_ARG_VARIADIC_INFO(0, sketches)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_sketch_quantile, 0, 0, 2)
+	ZEND_ARG_INFO(0, sketch)
+	ZEND_ARG_INFO(0, q)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_pinba_script_name_set, 0, 0, 1)
 	ZEND_ARG_INFO(0, custom_script_name)
 ZEND_END_ARG_INFO()
@@ -2501,6 +5303,7 @@ zend_function_entry pinba_functions[] = {
 	PINBA_FUNC(pinba_timer_start)
 	PINBA_FUNC(pinba_timer_add)
 	PINBA_FUNC(pinba_timer_stop)
+	PINBA_FUNC(pinba_timer_restart)
 	PINBA_FUNC(pinba_timer_delete)
 	PINBA_FUNC(pinba_timer_data_merge)
 	PINBA_FUNC(pinba_timer_data_replace)
@@ -2510,9 +5313,16 @@ zend_function_entry pinba_functions[] = {
 	PINBA_FUNC(pinba_reset)
 	PINBA_FUNC(pinba_get_info)
 	PINBA_FUNC(pinba_get_data)
+	PINBA_FUNC(pinba_decode)
 	PINBA_FUNC(pinba_timer_get_info)
+	PINBA_FUNC(pinba_timers_add)
 	PINBA_FUNC(pinba_timers_stop)
 	PINBA_FUNC(pinba_timers_get)
+	PINBA_FUNC(pinba_measure)
+	PINBA_FUNC(pinba_tagset_create)
+	PINBA_FUNC(pinba_tagset_get_tags)
+	PINBA_FUNC(pinba_sketch_merge)
+	PINBA_FUNC(pinba_sketch_quantile)
 	PINBA_FUNC(pinba_script_name_set)
 	PINBA_FUNC(pinba_hostname_set)
 	PINBA_FUNC(pinba_server_name_set)
@@ -2547,6 +5357,10 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_settimer, 0, 0, 2)
 	ZEND_ARG_INFO(0, hit_count)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_addtimers, 0, 0, 1)
+	ZEND_ARG_INFO(0, batch)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_send, 0, 0, 0)
 	ZEND_ARG_INFO(0, flags)
 ZEND_END_ARG_INFO()
@@ -2574,12 +5388,52 @@ zend_function_entry pinba_client_methods[] = {
 	PHP_ME(PinbaClient, setTag, arginfo_settag, ZEND_ACC_PUBLIC)
 	PHP_ME(PinbaClient, setTimer, arginfo_settimer, ZEND_ACC_PUBLIC)
 	PHP_ME(PinbaClient, addTimer, arginfo_settimer, ZEND_ACC_PUBLIC)
+	PHP_ME(PinbaClient, addTimers, arginfo_addtimers, ZEND_ACC_PUBLIC)
 	PHP_ME(PinbaClient, send, arginfo_send, ZEND_ACC_PUBLIC)
 	PHP_ME(PinbaClient, getData, arginfo_getdata, ZEND_ACC_PUBLIC)
 	{NULL, NULL, NULL}
 };
 /* }}} */
 
+/* {{{ arginfo */
+ZEND_BEGIN_ARG_INFO_EX(arginfo_timer_void, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_timer_data, 0, 0, 1)
+	ZEND_ARG_INFO(0, data)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_timer_tags, 0, 0, 1)
+	ZEND_ARG_INFO(0, tags)
+ZEND_END_ARG_INFO()
+/* }}} */
+
+/* {{{ pinba_timer_methods[]
+   the pinba_timer_*() functions take the timer as their first argument instead of $this */
+zend_function_entry pinba_timer_methods[] = {
+	PHP_ME_MAPPING(start, pinba_timer_start, arginfo_pinba_timer_start, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	PHP_ME_MAPPING(add, pinba_timer_add, arginfo_pinba_timer_add, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	PHP_ME_MAPPING(stop, pinba_timer_stop, arginfo_timer_void, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(restart, pinba_timer_restart, arginfo_timer_void, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(delete, pinba_timer_delete, arginfo_timer_void, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(dataMerge, pinba_timer_data_merge, arginfo_timer_data, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(dataReplace, pinba_timer_data_replace, arginfo_timer_data, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(tagsMerge, pinba_timer_tags_merge, arginfo_timer_tags, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(tagsReplace, pinba_timer_tags_replace, arginfo_timer_tags, ZEND_ACC_PUBLIC)
+	PHP_ME_MAPPING(getInfo, pinba_timer_get_info, arginfo_timer_void, ZEND_ACC_PUBLIC)
+	{NULL, NULL, NULL}
+};
+/* }}} */
+
+/* {{{ pinba_tagset_methods[]
+ */
+zend_function_entry pinba_tagset_methods[] = {
+	PHP_ME_MAPPING(create, pinba_tagset_create, arginfo_pinba_tagset_create, ZEND_ACC_PUBLIC | ZEND_ACC_STATIC)
+	PHP_ME_MAPPING(getTags, pinba_tagset_get_tags, arginfo_timer_void, ZEND_ACC_PUBLIC)
+	{NULL, NULL, NULL}
+};
+/* }}} */
+
 static void php_pinba_sa_dtor(zval *zv) /* {{{ */
 {
 	pinba_sockaddr *sa = Z_PTR_P(zv);
@@ -2633,6 +5487,189 @@ static PHP_INI_MH(OnUpdateCollectorAddress) /* {{{ */
 }
 /* }}} */
 
+static PHP_INI_MH(OnUpdateTimerCpu) /* {{{ */
+{
+	if (new_value == NULL) {
+		return FAILURE;
+	}
+
+	if (strcasecmp(ZSTR_VAL(new_value), "rusage") == 0) {
+		pinba_cpu_mode = PINBA_CPU_RUSAGE;
+	} else if (strcasecmp(ZSTR_VAL(new_value), "thread") == 0) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+		pinba_cpu_mode = PINBA_CPU_THREAD;
+#else
+		pinba_cpu_mode = PINBA_CPU_RUSAGE;
+#endif
+	} else if (strcasecmp(ZSTR_VAL(new_value), "off") == 0) {
+		pinba_cpu_mode = PINBA_CPU_OFF;
+	} else {
+		return FAILURE;
+	}
+
+	return OnUpdateString(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+}
+/* }}} */
+
+static PHP_INI_MH(OnUpdateAutoTimers) /* {{{ */
+{
+	const char *p, *end, *word;
+	size_t i;
+	int flags = 0;
+
+	if (new_value == NULL) {
+		return FAILURE;
+	}
+
+	/* comma or space separated names */
+	p = ZSTR_VAL(new_value);
+	end = p + ZSTR_LEN(new_value);
+	while (p < end) {
+		while (p < end && (*p == ',' || *p == ' ')) {
+			p++;
+		}
+		word = p;
+		while (p < end && *p != ',' && *p != ' ') {
+			p++;
+		}
+		if (p == word) {
+			break;
+		}
+
+		for (i = 0; i < PINBA_AUTO_TIMERS_NUM; i++) {
+			if (strlen(pinba_auto_timer_names[i]) == (size_t)(p - word) && strncasecmp(word, pinba_auto_timer_names[i], p - word) == 0) {
+				break;
+			}
+		}
+		if (i == PINBA_AUTO_TIMERS_NUM) {
+			return FAILURE;
+		}
+		flags |= 1 << i;
+	}
+
+	/* the rest is ignored by older PHP versions, phpinfo() shows what is in use */
+	pinba_auto_timers = flags & PINBA_AUTO_SUPPORTED;
+
+	return OnUpdateString(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+}
+/* }}} */
+
+static void php_pinba_observe_patterns_free(void) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < pinba_observe_patterns_num; i++) {
+		free(pinba_observe_patterns[i].class_name);
+		free(pinba_observe_patterns[i].name);
+	}
+	free(pinba_observe_patterns);
+	pinba_observe_patterns = NULL;
+	pinba_observe_patterns_num = 0;
+}
+/* }}} */
+
+static PHP_INI_MH(OnUpdateObserveFunctions) /* {{{ */
+{
+	const char *p, *end, *word, *sep;
+	pinba_observe_pattern *patterns = NULL, *pattern;
+	int num = 0;
+
+	if (new_value == NULL) {
+		return FAILURE;
+	}
+
+	/* comma or space separated, names are compared case-insensitively like PHP does */
+	p = ZSTR_VAL(new_value);
+	end = p + ZSTR_LEN(new_value);
+	while (p < end) {
+		while (p < end && (*p == ',' || *p == ' ')) {
+			p++;
+		}
+		if (p < end && *p == '\\') {
+			p++;
+		}
+		word = p;
+		while (p < end && *p != ',' && *p != ' ') {
+			p++;
+		}
+		if (p == word) {
+			break;
+		}
+
+		patterns = realloc(patterns, sizeof(pinba_observe_pattern) * (num + 1));
+		if (!patterns) {
+			return FAILURE;
+		}
+		pattern = &patterns[num++];
+		memset(pattern, 0, sizeof(*pattern));
+
+		sep = zend_memnstr(word, "::", 2, p);
+		if (sep) {
+			if (sep == word || sep + 2 == p) {
+				goto failure;
+			}
+			pattern->class_name = strndup(word, sep - word);
+			pattern->class_len = sep - word;
+			word = sep + 2;
+		}
+		if (p - word != 1 || *word != '*') {
+			pattern->name = strndup(word, p - word);
+			pattern->name_len = p - word;
+		} else if (!pattern->class_name) {
+			goto failure;
+		}
+	}
+
+	php_pinba_observe_patterns_free();
+	pinba_observe_patterns = patterns;
+	pinba_observe_patterns_num = num;
+
+	return OnUpdateString(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+
+failure:
+	while (num-- > 0) {
+		free(patterns[num].class_name);
+		free(patterns[num].name);
+	}
+	free(patterns);
+	return FAILURE;
+}
+/* }}} */
+
+static PHP_INI_MH(OnUpdateClock) /* {{{ */
+{
+	if (new_value == NULL) {
+		return FAILURE;
+	}
+
+	if (strcasecmp(ZSTR_VAL(new_value), "monotonic") == 0) {
+		pinba_clock_source = PINBA_CLOCK_MONOTONIC;
+		pinba_clock_id = CLOCK_MONOTONIC;
+	} else if (strcasecmp(ZSTR_VAL(new_value), "monotonic_coarse") == 0) {
+#ifdef CLOCK_MONOTONIC_COARSE
+		pinba_clock_source = PINBA_CLOCK_MONOTONIC_COARSE;
+		pinba_clock_id = CLOCK_MONOTONIC_COARSE;
+#else
+		pinba_clock_source = PINBA_CLOCK_MONOTONIC;
+		pinba_clock_id = CLOCK_MONOTONIC;
+#endif
+	} else if (strcasecmp(ZSTR_VAL(new_value), "tsc") == 0) {
+		/* fall back to CLOCK_MONOTONIC if there's no usable TSC, phpinfo() shows the clock in use */
+		pinba_clock_source = PINBA_CLOCK_MONOTONIC;
+		pinba_clock_id = CLOCK_MONOTONIC;
+#ifdef PINBA_HAVE_TSC
+		if (php_pinba_tsc_calibrate() == SUCCESS) {
+			pinba_clock_source = PINBA_CLOCK_TSC;
+		}
+#endif
+	} else {
+		return FAILURE;
+	}
+
+	return OnUpdateString(entry, new_value, mh_arg1, mh_arg2, mh_arg3, stage);
+}
+/* }}} */
+
 /* {{{ PHP_INI
  */
 PHP_INI_BEGIN()
@@ -2640,6 +5677,14 @@ PHP_INI_BEGIN()
     STD_PHP_INI_ENTRY("pinba.resolve_interval", "60", PHP_INI_ALL, OnUpdateLongGEZero, resolve_interval, zend_pinba_globals, pinba_globals)
     STD_PHP_INI_ENTRY("pinba.enabled", "0", PHP_INI_ALL, OnUpdateBool, enabled, zend_pinba_globals, pinba_globals)
     STD_PHP_INI_ENTRY("pinba.auto_flush", "1", PHP_INI_ALL, OnUpdateBool, auto_flush, zend_pinba_globals, pinba_globals)
+    STD_PHP_INI_ENTRY("pinba.clock", "monotonic", PHP_INI_SYSTEM, OnUpdateClock, clock, zend_pinba_globals, pinba_globals)
+    STD_PHP_INI_ENTRY("pinba.timer_nesting", "0", PHP_INI_ALL, OnUpdateBool, timer_nesting, zend_pinba_globals, pinba_globals)
+    STD_PHP_INI_ENTRY("pinba.timer_histograms", "0", PHP_INI_ALL, OnUpdateBool, timer_histograms, zend_pinba_globals, pinba_globals)
+    STD_PHP_INI_ENTRY("pinba.sketches", "0", PHP_INI_ALL, OnUpdateBool, sketches, zend_pinba_globals, pinba_globals)
+    STD_PHP_INI_ENTRY("pinba.max_timers", "0", PHP_INI_ALL, OnUpdateLongGEZero, max_timers, zend_pinba_globals, pinba_globals)
+    STD_PHP_INI_ENTRY("pinba.timer_cpu", "rusage", PHP_INI_SYSTEM, OnUpdateTimerCpu, timer_cpu, zend_pinba_globals, pinba_globals)
+    STD_PHP_INI_ENTRY("pinba.auto_timers", "", PHP_INI_SYSTEM, OnUpdateAutoTimers, auto_timers, zend_pinba_globals, pinba_globals)
+    STD_PHP_INI_ENTRY("pinba.observe_functions", "", PHP_INI_SYSTEM, OnUpdateObserveFunctions, observe_functions, zend_pinba_globals, pinba_globals)
 PHP_INI_END()
 /* }}} */
 
@@ -2650,8 +5695,19 @@ static void php_pinba_init_globals(zend_pinba_globals *globals)
 	memset(globals, 0, sizeof(*globals));
 
 	globals->timers_stopped = 0;
+	/* nothing is recorded before the first request, opcache preloading compiles files at startup */
+	globals->in_rshutdown = 1;
 	globals->server_name = NULL;
 	globals->script_name = NULL;
+	php_pinba_arena_init(&globals->timers_arena, PINBA_TIMERS_ARENA_CHUNK_SIZE, 1);
+}
+/* }}} */
+
+/* {{{ php_pinba_shutdown_globals
+ */
+static void php_pinba_shutdown_globals(zend_pinba_globals *globals)
+{
+	php_pinba_arena_destroy(&globals->timers_arena);
 }
 /* }}} */
 
@@ -2661,10 +5717,15 @@ static PHP_MINIT_FUNCTION(pinba)
 {
 	zend_class_entry ce;
 
-	ZEND_INIT_MODULE_GLOBALS(pinba, php_pinba_init_globals, NULL);
+	ZEND_INIT_MODULE_GLOBALS(pinba, php_pinba_init_globals, php_pinba_shutdown_globals);
 	REGISTER_INI_ENTRIES();
 
-	le_pinba_timer = zend_register_list_destructors_ex(php_timer_resource_dtor, NULL, "pinba timer", module_number);
+#ifdef PINBA_HAVE_OBSERVER
+	if ((pinba_auto_timers & PINBA_AUTO_OBSERVED) || pinba_observe_patterns_num) {
+		zend_observer_fcall_register(php_pinba_observer_init);
+	}
+#endif
+	php_pinba_engine_hooks_startup();
 
 	REGISTER_LONG_CONSTANT("PINBA_FLUSH_ONLY_STOPPED_TIMERS", PINBA_FLUSH_ONLY_STOPPED_TIMERS, CONST_CS | CONST_PERSISTENT);
 	REGISTER_LONG_CONSTANT("PINBA_FLUSH_RESET_DATA", PINBA_FLUSH_RESET_DATA, CONST_CS | CONST_PERSISTENT);
@@ -2687,6 +5748,40 @@ static PHP_MINIT_FUNCTION(pinba)
 	pinba_client_handlers.clone_obj = NULL;
 	pinba_client_handlers.offset = XtOffsetOf(pinba_client_t, std);
 
+	INIT_CLASS_ENTRY(ce, "PinbaTimer", pinba_timer_methods);
+	pinba_timer_ce = zend_register_internal_class_ex(&ce, NULL);
+	pinba_timer_ce->ce_flags |= ZEND_ACC_FINAL;
+#ifdef ZEND_ACC_NOT_SERIALIZABLE
+	pinba_timer_ce->ce_flags |= ZEND_ACC_NOT_SERIALIZABLE;
+#else
+	pinba_timer_ce->serialize = zend_class_serialize_deny;
+	pinba_timer_ce->unserialize = zend_class_unserialize_deny;
+#endif
+	pinba_timer_ce->create_object = pinba_timer_new;
+
+	memcpy(&pinba_timer_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	pinba_timer_handlers.free_obj = pinba_timer_free_storage;
+	pinba_timer_handlers.get_constructor = pinba_timer_get_constructor;
+	pinba_timer_handlers.clone_obj = NULL;
+	pinba_timer_handlers.offset = XtOffsetOf(pinba_timer_object, std);
+
+	INIT_CLASS_ENTRY(ce, "PinbaTagSet", pinba_tagset_methods);
+	pinba_tagset_ce = zend_register_internal_class_ex(&ce, NULL);
+	pinba_tagset_ce->ce_flags |= ZEND_ACC_FINAL;
+#ifdef ZEND_ACC_NOT_SERIALIZABLE
+	pinba_tagset_ce->ce_flags |= ZEND_ACC_NOT_SERIALIZABLE;
+#else
+	pinba_tagset_ce->serialize = zend_class_serialize_deny;
+	pinba_tagset_ce->unserialize = zend_class_unserialize_deny;
+#endif
+	pinba_tagset_ce->create_object = pinba_tagset_new;
+
+	memcpy(&pinba_tagset_handlers, zend_get_std_object_handlers(), sizeof(zend_object_handlers));
+	pinba_tagset_handlers.free_obj = pinba_tagset_free_storage;
+	pinba_tagset_handlers.get_constructor = pinba_tagset_get_constructor;
+	pinba_tagset_handlers.clone_obj = NULL;
+	pinba_tagset_handlers.offset = XtOffsetOf(pinba_tagset_object, std);
+
 	zend_hash_init(&resolver_cache, 10, NULL, php_pinba_sa_dtor, 1);
 	return SUCCESS;
 }
@@ -2697,9 +5792,15 @@ static PHP_MINIT_FUNCTION(pinba)
 static PHP_MSHUTDOWN_FUNCTION(pinba)
 {
 	UNREGISTER_INI_ENTRIES();
+	php_pinba_observe_patterns_free();
+	php_pinba_engine_hooks_shutdown();
 
 	php_pinba_cleanup_collectors(PINBA_G(collectors), &PINBA_G(n_collectors));
 
+#ifndef ZTS
+	php_pinba_shutdown_globals(&pinba_globals);
+#endif
+
 	zend_hash_destroy(&resolver_cache);
 	return SUCCESS;
 }
@@ -2710,20 +5811,15 @@ static PHP_MSHUTDOWN_FUNCTION(pinba)
 static PHP_RINIT_FUNCTION(pinba)
 {
 	zval *tmp;
-	struct timeval t;
 	struct rusage u;
 
 	PINBA_G(timers_stopped) = 0;
 	PINBA_G(in_rshutdown) = 0;
 	PINBA_G(request_time) = 0;
 
-	if (gettimeofday(&t, 0) == 0) {
-		timeval_cvt(&(PINBA_G(tmp_req_data).req_start), &t);
-	} else {
-		return FAILURE;
-	}
+	PINBA_G(tmp_req_data).req_start = php_pinba_clock_ns();
 
-	if (getrusage(RUSAGE_SELF, &u) == 0) {
+	if (getrusage(PINBA_RUSAGE_WHO, &u) == 0) {
 		timeval_cvt(&(PINBA_G(tmp_req_data).ru_utime), &u.ru_utime);
 		timeval_cvt(&(PINBA_G(tmp_req_data).ru_stime), &u.ru_stime);
 	} else {
@@ -2732,6 +5828,27 @@ static PHP_RINIT_FUNCTION(pinba)
 
 	zend_hash_init(&PINBA_G(timers), 10, NULL, NULL, 0);
 	zend_hash_init(&PINBA_G(tags), 10, NULL, php_tag_hash_dtor, 0);
+	zend_hash_init(&PINBA_G(measure_timers), 8, NULL, php_measure_hash_dtor, 0);
+	zend_hash_init(&PINBA_G(measure_literals), 8, NULL, NULL, 0);
+	zend_hash_init(&PINBA_G(timers_folded), 8, NULL, php_folded_hash_dtor, 0);
+	PINBA_G(overflow_timer) = NULL;
+	zend_hash_init(&PINBA_G(dict), 32, NULL, NULL, 0);
+#ifdef PINBA_HAVE_OBSERVER
+	zend_hash_init(&PINBA_G(db_links), 8, NULL, php_db_link_hash_dtor, 0);
+	zend_hash_init(&PINBA_G(observed_functions), 8, NULL, php_observed_function_hash_dtor, 0);
+	zend_hash_init(&PINBA_G(curl_handles), 8, NULL, NULL, 0);
+	PINBA_G(observe_depth) = 0;
+#endif
+	PINBA_G(autoload_depth) = 0;
+	if (++PINBA_G(dict_gen) == 0) {
+		PINBA_G(dict_gen) = 1;
+	}
+
+	/* all timers of the previous request are gone by now */
+	php_pinba_arena_reset(&PINBA_G(timers_arena));
+	PINBA_G(timers_list).first = PINBA_G(timers_list).last = NULL;
+	PINBA_G(running_timers_list).first = PINBA_G(running_timers_list).last = NULL;
+	PINBA_G(timer_stack_top) = NULL;
 
 	PINBA_G(tmp_req_data).doc_size = 0;
 	PINBA_G(tmp_req_data).mem_peak_usage= 0;
@@ -2765,9 +5882,23 @@ static PHP_RSHUTDOWN_FUNCTION(pinba)
 	if (PINBA_G(auto_flush)) {
 		php_pinba_flush_data(NULL, 0);
 	}
+	/* timers freed by the hashes below mustn't touch PINBA_G(timers) or fold into PINBA_G(timers_folded) */
+	PINBA_G(in_rshutdown) = 1;
 
 	zend_hash_destroy(&PINBA_G(timers));
 	zend_hash_destroy(&PINBA_G(tags));
+	zend_hash_destroy(&PINBA_G(measure_literals));
+	zend_hash_destroy(&PINBA_G(measure_timers));
+	zend_hash_destroy(&PINBA_G(timers_folded));
+	PINBA_G(overflow_timer) = NULL;
+	/* tags and histograms of the timer objects still alive go with it, see php_pinba_timers_free() */
+	php_pinba_arena_reset(&PINBA_G(timers_arena));
+	zend_hash_destroy(&PINBA_G(dict));
+#ifdef PINBA_HAVE_OBSERVER
+	zend_hash_destroy(&PINBA_G(db_links));
+	zend_hash_destroy(&PINBA_G(observed_functions));
+	zend_hash_destroy(&PINBA_G(curl_handles));
+#endif
 
 #if PHP_VERSION_ID < 50400
 	OG(php_header_write) = PINBA_G(old_sapi_ub_write);
@@ -2781,7 +5912,6 @@ static PHP_RSHUTDOWN_FUNCTION(pinba)
 		efree(PINBA_G(script_name));
 		PINBA_G(script_name) = NULL;
 	}
-	PINBA_G(in_rshutdown) = 1;
 	return SUCCESS;
 }
 /* }}} */
@@ -2794,6 +5924,19 @@ static PHP_MINFO_FUNCTION(pinba)
 	php_info_print_table_start();
 	php_info_print_table_header(2, "Pinba support", "enabled");
 	php_info_print_table_row(2, "Extension version", PHP_PINBA_VERSION);
+	php_info_print_table_row(2, "Clock source", pinba_clock_names[pinba_clock_source]);
+	php_info_print_table_row(2, "Timer CPU accounting", pinba_cpu_names[pinba_cpu_mode]);
+	{
+		char auto_timers[128] = "";
+		size_t i, len = 0;
+
+		for (i = 0; i < PINBA_AUTO_TIMERS_NUM; i++) {
+			if (pinba_auto_timers & (1 << i)) {
+				len += snprintf(auto_timers + len, sizeof(auto_timers) - len, "%s%s", len ? ", " : "", pinba_auto_timer_names[i]);
+			}
+		}
+		php_info_print_table_row(2, "Automatic timers", len ? auto_timers : "none");
+	}
 	php_info_print_table_end();
 
 	DISPLAY_INI_ENTRIES();
@@ -55,10 +55,30 @@ struct  _Pinba__Request
   float *timer_ru_utime;
   size_t n_timer_ru_stime;
   float *timer_ru_stime;
+  size_t n_timer_parent;
+  uint32_t *timer_parent;
+  size_t n_timer_self_value;
+  float *timer_self_value;
+  size_t n_timer_hist_count;
+  uint32_t *timer_hist_count;
+  size_t n_timer_hist_bucket;
+  uint32_t *timer_hist_bucket;
+  size_t n_timer_hist_hits;
+  uint32_t *timer_hist_hits;
+  size_t n_timer_min_value;
+  float *timer_min_value;
+  size_t n_timer_max_value;
+  float *timer_max_value;
+  protobuf_c_boolean has_request_time_sketch;
+  ProtobufCBinaryData request_time_sketch;
+  size_t n_timer_sketch;
+  ProtobufCBinaryData *timer_sketch;
+  size_t n_timer_counter;
+  uint64_t *timer_counter;
 };
 #define PINBA__REQUEST__INIT \
  { PROTOBUF_C_MESSAGE_INIT (&pinba__request__descriptor) \
-    , NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,0, 0,0, 0,NULL, NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL }
+    , NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,0, 0,0, 0,NULL, NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,NULL, 0,{0,NULL}, 0,NULL, 0,NULL }
 
 
 /* Pinba__Request methods */
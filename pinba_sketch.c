@@ -0,0 +1,472 @@
+/*
+ * Authors: Antony Dovgal <tony@daylessday.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pinba_sketch.h"
+
+/* serialized format:
+ *   version byte, varint alpha in ppm, varint zero_count,
+ *   min, max and sum as little endian doubles,
+ *   zigzag varint key of the first bin, varint number of bins, varint counts */
+#define PINBA_SKETCH_VERSION 1
+/* extra bins allocated when the window grows, saves reallocations for a slowly drifting range */
+#define PINBA_SKETCH_GROW 32
+
+int pinba_sketch_init(pinba_sketch *sketch, double alpha) /* {{{ */
+{
+	uint32_t ppm;
+
+	if (!(alpha > 0 && alpha < 1)) {
+		return -1;
+	}
+
+	ppm = (uint32_t)(alpha * 1000000 + 0.5);
+	if (ppm == 0 || ppm >= 1000000) {
+		return -1;
+	}
+
+	memset(sketch, 0, sizeof(*sketch));
+	sketch->alpha = ppm / 1000000.0;
+	sketch->gamma_ln = log((1 + sketch->alpha) / (1 - sketch->alpha));
+	return 0;
+}
+/* }}} */
+
+void pinba_sketch_destroy(pinba_sketch *sketch) /* {{{ */
+{
+	free(sketch->bins);
+	sketch->bins = NULL;
+	sketch->n_bins = 0;
+	sketch->offset = 0;
+	pinba_sketch_reset(sketch);
+}
+/* }}} */
+
+void pinba_sketch_reset(pinba_sketch *sketch) /* {{{ */
+{
+	if (sketch->bins) {
+		memset(sketch->bins, 0, sizeof(uint64_t) * sketch->n_bins);
+	}
+	sketch->count = 0;
+	sketch->zero_count = 0;
+	sketch->min = 0;
+	sketch->max = 0;
+	sketch->sum = 0;
+}
+/* }}} */
+
+static inline int32_t pinba_sketch_key(const pinba_sketch *sketch, double value) /* {{{ */
+{
+	return (int32_t)ceil(log(value) / sketch->gamma_ln);
+}
+/* }}} */
+
+static inline double pinba_sketch_value(const pinba_sketch *sketch, int32_t key) /* {{{ */
+{
+	/* the middle of (gamma^(key-1), gamma^key] in terms of relative error */
+	return exp(key * sketch->gamma_ln) * (1 - sketch->alpha);
+}
+/* }}} */
+
+/* make the window cover keys lo..hi, collapsing the lowest bins if it gets too wide */
+static int pinba_sketch_reserve(pinba_sketch *sketch, int32_t lo, int32_t hi) /* {{{ */
+{
+	int64_t data_lo = lo, data_hi = hi, new_lo, new_hi, room;
+	uint64_t *bins;
+	uint32_t i, n;
+
+	if (sketch->n_bins) {
+		int64_t cur_hi = (int64_t)sketch->offset + sketch->n_bins - 1;
+
+		if (lo >= sketch->offset && hi <= cur_hi) {
+			return 0;
+		}
+		if (sketch->offset < data_lo) {
+			data_lo = sketch->offset;
+		}
+		if (cur_hi > data_hi) {
+			data_hi = cur_hi;
+		}
+	}
+
+	new_lo = data_lo;
+	new_hi = data_hi;
+	if (data_hi - data_lo + 1 > PINBA_SKETCH_MAX_BINS) {
+		new_lo = data_hi - PINBA_SKETCH_MAX_BINS + 1;
+	} else {
+		room = PINBA_SKETCH_MAX_BINS - (data_hi - data_lo + 1);
+		if (hi > (int64_t)sketch->offset + sketch->n_bins - 1 || !sketch->n_bins) {
+			new_hi += room < PINBA_SKETCH_GROW ? room : PINBA_SKETCH_GROW;
+			room -= new_hi - data_hi;
+		}
+		if (lo < sketch->offset || !sketch->n_bins) {
+			new_lo -= room < PINBA_SKETCH_GROW ? room : PINBA_SKETCH_GROW;
+		}
+	}
+
+	n = (uint32_t)(new_hi - new_lo + 1);
+	bins = calloc(n, sizeof(uint64_t));
+	if (!bins) {
+		return -1;
+	}
+
+	for (i = 0; i < sketch->n_bins; i++) {
+		int64_t key = (int64_t)sketch->offset + i;
+
+		if (sketch->bins[i]) {
+			bins[key < new_lo ? 0 : key - new_lo] += sketch->bins[i];
+		}
+	}
+
+	free(sketch->bins);
+	sketch->bins = bins;
+	sketch->n_bins = n;
+	sketch->offset = (int32_t)new_lo;
+	return 0;
+}
+/* }}} */
+
+static inline void pinba_sketch_minmax(pinba_sketch *sketch, double min, double max) /* {{{ */
+{
+	if (sketch->count == 0 || min < sketch->min) {
+		sketch->min = min;
+	}
+	if (sketch->count == 0 || max > sketch->max) {
+		sketch->max = max;
+	}
+}
+/* }}} */
+
+int pinba_sketch_add(pinba_sketch *sketch, double value, uint64_t count) /* {{{ */
+{
+	int32_t key;
+
+	if (count == 0 || value != value) {
+		return 0;
+	}
+
+	if (value < PINBA_SKETCH_MIN_VALUE) {
+		sketch->zero_count += count;
+	} else {
+		key = pinba_sketch_key(sketch, value);
+		if (pinba_sketch_reserve(sketch, key, key) != 0) {
+			return -1;
+		}
+		if (key < sketch->offset) {
+			key = sketch->offset;
+		}
+		sketch->bins[key - sketch->offset] += count;
+	}
+
+	pinba_sketch_minmax(sketch, value, value);
+	sketch->count += count;
+	sketch->sum += value * count;
+	return 0;
+}
+/* }}} */
+
+int pinba_sketch_merge(pinba_sketch *dst, const pinba_sketch *src) /* {{{ */
+{
+	uint32_t i, first = 0, last = 0;
+	int have_bins = 0;
+
+	if (dst->alpha != src->alpha) {
+		return -1;
+	}
+	if (src->count == 0) {
+		return 0;
+	}
+
+	for (i = 0; i < src->n_bins; i++) {
+		if (src->bins[i]) {
+			if (!have_bins) {
+				first = i;
+				have_bins = 1;
+			}
+			last = i;
+		}
+	}
+
+	if (have_bins) {
+		if (pinba_sketch_reserve(dst, src->offset + (int32_t)first, src->offset + (int32_t)last) != 0) {
+			return -1;
+		}
+		for (i = first; i <= last; i++) {
+			int32_t key = src->offset + (int32_t)i;
+
+			if (key < dst->offset) {
+				key = dst->offset;
+			}
+			dst->bins[key - dst->offset] += src->bins[i];
+		}
+	}
+
+	pinba_sketch_minmax(dst, src->min, src->max);
+	dst->count += src->count;
+	dst->zero_count += src->zero_count;
+	dst->sum += src->sum;
+	return 0;
+}
+/* }}} */
+
+double pinba_sketch_quantile(const pinba_sketch *sketch, double q) /* {{{ */
+{
+	double rank, value;
+	uint64_t seen;
+	uint32_t i;
+
+	if (sketch->count == 0) {
+		return 0;
+	}
+	if (q <= 0) {
+		return sketch->min;
+	}
+	if (q >= 1) {
+		return sketch->max;
+	}
+
+	rank = q * (sketch->count - 1);
+	seen = sketch->zero_count;
+	if (seen > rank) {
+		return sketch->min;
+	}
+
+	for (i = 0; i < sketch->n_bins; i++) {
+		seen += sketch->bins[i];
+		if (seen > rank) {
+			value = pinba_sketch_value(sketch, sketch->offset + (int32_t)i);
+			if (value < sketch->min) {
+				return sketch->min;
+			}
+			if (value > sketch->max) {
+				return sketch->max;
+			}
+			return value;
+		}
+	}
+	return sketch->max;
+}
+/* }}} */
+
+static inline size_t pinba_sketch_varint_size(uint64_t v) /* {{{ */
+{
+	size_t n = 1;
+
+	while (v >= 0x80) {
+		v >>= 7;
+		n++;
+	}
+	return n;
+}
+/* }}} */
+
+static inline size_t pinba_sketch_put_varint(uint8_t *out, uint64_t v) /* {{{ */
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		out[n++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	out[n++] = (uint8_t)v;
+	return n;
+}
+/* }}} */
+
+static inline int pinba_sketch_get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) /* {{{ */
+{
+	const uint8_t *s = *p;
+	unsigned shift = 0;
+
+	*v = 0;
+	while (s < end && shift < 64) {
+		*v |= (uint64_t)(*s & 0x7f) << shift;
+		if (!(*s++ & 0x80)) {
+			*p = s;
+			return 0;
+		}
+		shift += 7;
+	}
+	return -1;
+}
+/* }}} */
+
+static inline size_t pinba_sketch_put_double(uint8_t *out, double d) /* {{{ */
+{
+	uint64_t v;
+	int i;
+
+	memcpy(&v, &d, sizeof(v));
+	for (i = 0; i < 8; i++) {
+		out[i] = (uint8_t)(v >> (i * 8));
+	}
+	return 8;
+}
+/* }}} */
+
+static inline int pinba_sketch_get_double(const uint8_t **p, const uint8_t *end, double *d) /* {{{ */
+{
+	uint64_t v = 0;
+	int i;
+
+	if (end - *p < 8) {
+		return -1;
+	}
+	for (i = 0; i < 8; i++) {
+		v |= (uint64_t)(*p)[i] << (i * 8);
+	}
+	memcpy(d, &v, sizeof(v));
+	*p += 8;
+	return 0;
+}
+/* }}} */
+
+static inline uint32_t pinba_sketch_zigzag(int32_t v) /* {{{ */
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+/* }}} */
+
+/* the range of non-empty bins, returns the number of bins to write */
+static uint32_t pinba_sketch_used_bins(const pinba_sketch *sketch, uint32_t *first) /* {{{ */
+{
+	uint32_t lo = 0, hi = sketch->n_bins;
+
+	while (lo < hi && sketch->bins[lo] == 0) {
+		lo++;
+	}
+	while (hi > lo && sketch->bins[hi - 1] == 0) {
+		hi--;
+	}
+	*first = lo;
+	return hi - lo;
+}
+/* }}} */
+
+size_t pinba_sketch_serialized_size(const pinba_sketch *sketch) /* {{{ */
+{
+	uint32_t i, first, n;
+	int32_t key;
+	size_t size;
+
+	n = pinba_sketch_used_bins(sketch, &first);
+	key = sketch->offset + (int32_t)first;
+
+	size = 1 + pinba_sketch_varint_size((uint64_t)(sketch->alpha * 1000000 + 0.5));
+	size += pinba_sketch_varint_size(sketch->zero_count) + 3 * 8;
+	size += pinba_sketch_varint_size(pinba_sketch_zigzag(key));
+	size += pinba_sketch_varint_size(n);
+	for (i = first; i < first + n; i++) {
+		size += pinba_sketch_varint_size(sketch->bins[i]);
+	}
+	return size;
+}
+/* }}} */
+
+size_t pinba_sketch_serialize(const pinba_sketch *sketch, uint8_t *out) /* {{{ */
+{
+	uint32_t i, first, n;
+	int32_t key;
+	size_t len = 0;
+
+	n = pinba_sketch_used_bins(sketch, &first);
+	key = sketch->offset + (int32_t)first;
+
+	out[len++] = PINBA_SKETCH_VERSION;
+	len += pinba_sketch_put_varint(out + len, (uint64_t)(sketch->alpha * 1000000 + 0.5));
+	len += pinba_sketch_put_varint(out + len, sketch->zero_count);
+	len += pinba_sketch_put_double(out + len, sketch->min);
+	len += pinba_sketch_put_double(out + len, sketch->max);
+	len += pinba_sketch_put_double(out + len, sketch->sum);
+	len += pinba_sketch_put_varint(out + len, pinba_sketch_zigzag(key));
+	len += pinba_sketch_put_varint(out + len, n);
+	for (i = first; i < first + n; i++) {
+		len += pinba_sketch_put_varint(out + len, sketch->bins[i]);
+	}
+	return len;
+}
+/* }}} */
+
+int pinba_sketch_unserialize(pinba_sketch *sketch, const uint8_t *data, size_t len) /* {{{ */
+{
+	const uint8_t *p = data, *end = data + len;
+	uint64_t ppm, zkey, n, count;
+	int64_t key;
+	uint32_t i;
+
+	if (len < 1 || *p++ != PINBA_SKETCH_VERSION) {
+		return -1;
+	}
+	if (pinba_sketch_get_varint(&p, end, &ppm) != 0 || ppm == 0 || ppm >= 1000000) {
+		return -1;
+	}
+	if (pinba_sketch_init(sketch, ppm / 1000000.0) != 0) {
+		return -1;
+	}
+
+	if (pinba_sketch_get_varint(&p, end, &sketch->zero_count) != 0
+			|| pinba_sketch_get_double(&p, end, &sketch->min) != 0
+			|| pinba_sketch_get_double(&p, end, &sketch->max) != 0
+			|| pinba_sketch_get_double(&p, end, &sketch->sum) != 0
+			|| pinba_sketch_get_varint(&p, end, &zkey) != 0
+			|| pinba_sketch_get_varint(&p, end, &n) != 0) {
+		return -1;
+	}
+
+	key = (int64_t)(zkey >> 1) ^ -(int64_t)(zkey & 1);
+	if (n > PINBA_SKETCH_MAX_BINS || key < INT32_MIN || key + (int64_t)n > INT32_MAX || n > (uint64_t)(end - p)) {
+		return -1;
+	}
+
+	sketch->count = sketch->zero_count;
+	if (n) {
+		sketch->bins = calloc((size_t)n, sizeof(uint64_t));
+		if (!sketch->bins) {
+			return -1;
+		}
+		sketch->n_bins = (uint32_t)n;
+		sketch->offset = (int32_t)key;
+		for (i = 0; i < n; i++) {
+			if (pinba_sketch_get_varint(&p, end, &count) != 0) {
+				pinba_sketch_destroy(sketch);
+				return -1;
+			}
+			sketch->bins[i] = count;
+			sketch->count += count;
+		}
+	}
+
+	if (p != end) {
+		pinba_sketch_destroy(sketch);
+		return -1;
+	}
+	return 0;
+}
+/* }}} */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: noet sw=4 ts=4 fdm=marker
+ * vim<600: noet sw=4 ts=4
+ */
@@ -0,0 +1,77 @@
+/*
+ * Authors: Antony Dovgal <tony@daylessday.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef PINBA_SKETCH_H
+#define PINBA_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Mergeable quantile sketch (DDSketch): a value v is counted in the bin
+ * ceil(log(v) / log(gamma)), gamma = (1 + alpha) / (1 - alpha), so every
+ * quantile is returned with a relative error of at most alpha.
+ * Merging adds the bin counts, which makes it associative and commutative:
+ * sketches can be merged per request, per pool and per collector in any
+ * order with the same result.
+ *
+ * Bins are kept in a window of at most PINBA_SKETCH_MAX_BINS keys; if the
+ * values span more than that the lowest bins are collapsed, so the high
+ * quantiles (p99, p999) keep their error bound. With the default accuracy
+ * the window covers 1ns to over a day.
+ *
+ * The sketch is plain C with no PHP dependency and allocates with malloc().
+ */
+
+#define PINBA_SKETCH_DEFAULT_ALPHA 0.01
+#define PINBA_SKETCH_MAX_BINS 2048
+/* smaller values are counted as zero */
+#define PINBA_SKETCH_MIN_VALUE 1e-9
+
+typedef struct _pinba_sketch {
+	double alpha;
+	double gamma_ln;     /* log((1 + alpha) / (1 - alpha)) */
+	uint64_t count;
+	uint64_t zero_count;
+	double min;
+	double max;
+	double sum;
+	int32_t offset;      /* key of bins[0] */
+	uint32_t n_bins;
+	uint64_t *bins;
+} pinba_sketch;
+
+/* alpha is rounded to parts per million, returns -1 if it is not in (0, 1) */
+int pinba_sketch_init(pinba_sketch *sketch, double alpha);
+void pinba_sketch_destroy(pinba_sketch *sketch);
+void pinba_sketch_reset(pinba_sketch *sketch);
+
+/* these return -1 if out of memory; merging fails for sketches of different accuracy */
+int pinba_sketch_add(pinba_sketch *sketch, double value, uint64_t count);
+int pinba_sketch_merge(pinba_sketch *dst, const pinba_sketch *src);
+
+/* q in [0, 1], returns 0 for an empty sketch */
+double pinba_sketch_quantile(const pinba_sketch *sketch, double q);
+
+/* the buffer must hold pinba_sketch_serialized_size() bytes */
+size_t pinba_sketch_serialized_size(const pinba_sketch *sketch);
+size_t pinba_sketch_serialize(const pinba_sketch *sketch, uint8_t *out);
+/* initializes the sketch, returns -1 on malformed data */
+int pinba_sketch_unserialize(pinba_sketch *sketch, const uint8_t *data, size_t len);
+
+#endif /* PINBA_SKETCH_H */
@@ -803,6 +803,82 @@ sizeof_elt_in_repeated_array (ProtobufCType type)
   return 0;
 }
 
+/* Packing repeated fields element by element through required_field_pack()
+   re-encodes the same tag and re-dispatches on the field type for every
+   element.  Arrays of uint32 (dictionary ids, counters) and of 32-bit
+   fixed-size values (floats) make up the bulk of Pinba packets, so these
+   encode the tag once and run a tight loop over the array instead.
+   Both produce exactly the same bytes as the per-element path. */
+static size_t
+uint32_array_pack (const uint8_t *tag, size_t tag_len,
+                   size_t count, const uint32_t *values, uint8_t *out)
+{
+  size_t rv = 0;
+  size_t i;
+  if (tag_len == 1)
+    {
+      uint8_t t = tag[0];
+      for (i = 0; i < count; i++)
+        {
+          uint32_t v = values[i];
+          out[rv++] = t;
+          if (v < 0x80)
+            out[rv++] = v;
+          else
+            rv += uint32_pack (v, out + rv);
+        }
+      return rv;
+    }
+  for (i = 0; i < count; i++)
+    {
+      memcpy (out + rv, tag, tag_len);
+      rv += tag_len;
+      rv += uint32_pack (values[i], out + rv);
+    }
+  return rv;
+}
+
+static size_t
+fixed32_array_pack (const uint8_t *tag, size_t tag_len,
+                    size_t count, const uint32_t *values, uint8_t *out)
+{
+  size_t rv = 0;
+  size_t i;
+  for (i = 0; i < count; i++)
+    {
+      memcpy (out + rv, tag, tag_len);
+      rv += tag_len;
+      rv += fixed32_pack (values[i], out + rv);
+    }
+  return rv;
+}
+
+/* Pack up to COUNT elements of a uint32 or 32-bit fixed-size repeated field.
+   Returns (size_t)-1 for any other type, which must go through the generic path. */
+static size_t
+repeated_32bit_array_pack (const ProtobufCFieldDescriptor *field,
+                           size_t count,
+                           const uint32_t *values,
+                           uint8_t *out)
+{
+  uint8_t tag[MAX_UINT64_ENCODED_SIZE];
+  size_t tag_len = tag_pack (field->id, tag);
+  switch (field->type)
+    {
+    case PROTOBUF_C_TYPE_UINT32:
+    case PROTOBUF_C_TYPE_ENUM:
+      tag[0] |= PROTOBUF_C_WIRE_TYPE_VARINT;
+      return uint32_array_pack (tag, tag_len, count, values, out);
+    case PROTOBUF_C_TYPE_SFIXED32:
+    case PROTOBUF_C_TYPE_FIXED32:
+    case PROTOBUF_C_TYPE_FLOAT:
+      tag[0] |= PROTOBUF_C_WIRE_TYPE_32BIT;
+      return fixed32_array_pack (tag, tag_len, count, values, out);
+    default:
+      return (size_t) -1;
+    }
+}
+
 static size_t
 repeated_field_pack (const ProtobufCFieldDescriptor *field,
                      size_t count,
@@ -813,7 +889,13 @@ repeated_field_pack (const ProtobufCFieldDescriptor *field,
   size_t siz;
   unsigned i;
   size_t rv = 0;
-  /* CONSIDER: optimize this case a bit (by putting the loop inside the switch) */
+  if (count > 0)
+    {
+      rv = repeated_32bit_array_pack (field, count, (const uint32_t *) array, out);
+      if (rv != (size_t) -1)
+        return rv;
+      rv = 0;
+    }
   siz = sizeof_elt_in_repeated_array (field->type);
   for (i = 0; i < count; i++)
     {
@@ -867,6 +949,10 @@ protobuf_c_message_pack           (const ProtobufCMessage *message,
 }
 
 /* === pack_to_buffer() === */
+
+/* number of elements of a repeated field packed per buffer->append() */
+#define REPEATED_PACK_BATCH 128
+
 static size_t
 required_field_pack_to_buffer (const ProtobufCFieldDescriptor *field,
                                const void *member,
@@ -1002,8 +1088,26 @@ repeated_field_pack_to_buffer (const ProtobufCFieldDescriptor *field,
   char *array = * (char * const *) member;
   size_t siz;
   unsigned i;
-  /* CONSIDER: optimize this case a bit (by putting the loop inside the switch) */
   unsigned rv = 0;
+  if (field->type == PROTOBUF_C_TYPE_UINT32
+   || field->type == PROTOBUF_C_TYPE_ENUM
+   || field->type == PROTOBUF_C_TYPE_SFIXED32
+   || field->type == PROTOBUF_C_TYPE_FIXED32
+   || field->type == PROTOBUF_C_TYPE_FLOAT)
+    {
+      /* pack into a scratch area and append it in blocks,
+         instead of calling buffer->append() twice per element */
+      uint8_t scratch[REPEATED_PACK_BATCH * MAX_UINT64_ENCODED_SIZE * 2];
+      const uint32_t *values = (const uint32_t *) array;
+      for (i = 0; i < count; i += REPEATED_PACK_BATCH)
+        {
+          unsigned n = count - i < REPEATED_PACK_BATCH ? count - i : REPEATED_PACK_BATCH;
+          size_t len = repeated_32bit_array_pack (field, n, values + i, scratch);
+          buffer->append (buffer, len, scratch);
+          rv += len;
+        }
+      return rv;
+    }
   siz = sizeof_elt_in_repeated_array (field->type);
   for (i = 0; i < count; i++)
     {
@@ -1127,6 +1231,35 @@ parse_tag_and_wiretype (size_t len,
   return 0;                   /* error: bad header */
 }
 
+/* Return the length of the varint at DATA, or 0 if it isn't terminated
+   within MAX_LEN bytes.  Most varints are a single byte, so that is
+   checked first; longer ones are scanned a machine word at a time. */
+static inline unsigned
+scan_varint (unsigned max_len, const uint8_t *data)
+{
+  unsigned i;
+  if (max_len == 0)
+    return 0;
+  if ((data[0] & 0x80) == 0)
+    return 1;
+  i = 1;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  if (max_len >= 8)
+    {
+      uint64_t word, stop;
+      memcpy (&word, data, 8);
+      stop = ~word & 0x8080808080808080ULL;
+      if (stop != 0)
+        return (__builtin_ctzll (stop) >> 3) + 1;
+      i = 8;
+    }
+#endif
+  for (; i < max_len; i++)
+    if ((data[i] & 0x80) == 0)
+      return i + 1;
+  return 0;
+}
+
 /* sizeof(ScannedMember) must be <= (1<<BOUND_SIZEOF_SCANNED_MEMBER_LOG2) */
 #define BOUND_SIZEOF_SCANNED_MEMBER_LOG2  5
 typedef struct _ScannedMember ScannedMember;
@@ -1416,6 +1549,31 @@ parse_repeated_member (ScannedMember *scanned_member,
   return 1;
 }
 
+/* Decode a run of consecutive varint elements of the same repeated uint32
+   field straight into its array, bypassing the per-member type dispatch.
+   Returns the number of scanned members consumed (at least one). */
+static unsigned
+parse_repeated_uint32_run (const ScannedMember *members,
+                           unsigned max,
+                           ProtobufCMessage *message)
+{
+  const ProtobufCFieldDescriptor *field = members[0].field;
+  size_t *p_n = STRUCT_MEMBER_PTR (size_t, message, field->quantifier_offset);
+  uint32_t *array = STRUCT_MEMBER (uint32_t *, message, field->offset);
+  size_t n = *p_n;
+  unsigned j = 0;
+  do
+    {
+      array[n++] = parse_uint32 (members[j].len, members[j].data);
+      j++;
+    }
+  while (j < max
+      && members[j].field == field
+      && members[j].wire_type == PROTOBUF_C_WIRE_TYPE_VARINT);
+  *p_n = n;
+  return j;
+}
+
 static protobuf_c_boolean
 parse_member (ScannedMember *scanned_member,
               ProtobufCMessage *message,
@@ -1621,18 +1779,14 @@ protobuf_c_message_unpack         (const ProtobufCMessageDescriptor *desc,
         case PROTOBUF_C_WIRE_TYPE_VARINT:
           {
             unsigned max_len = rem < 10 ? rem : 10;
-            unsigned i;
-            for (i = 0; i < max_len; i++)
-              if ((at[i] & 0x80) == 0)
-                break;
-            if (i == max_len)
+            tmp.len = scan_varint (max_len, at);
+            if (tmp.len == 0)
               {
                 UNPACK_ERROR (("message '%s', field '%s': unterminated varint at offset %u",
                                desc->name, field ? field->name : "*unknown*",
                                (unsigned)(at-data)));
                 goto error_cleanup_during_scan;
               }
-            tmp.len = i + 1;
           }
           break;
         case PROTOBUF_C_WIRE_TYPE_64BIT:
@@ -1755,6 +1909,15 @@ protobuf_c_message_unpack         (const ProtobufCMessageDescriptor *desc,
       unsigned j;
       for (j = 0; j < max; j++)
         {
+          const ProtobufCFieldDescriptor *field = slab[j].field;
+          if (field != NULL
+           && field->label == PROTOBUF_C_LABEL_REPEATED
+           && field->type == PROTOBUF_C_TYPE_UINT32
+           && slab[j].wire_type == PROTOBUF_C_WIRE_TYPE_VARINT)
+            {
+              j += parse_repeated_uint32_run (slab + j, max - j, rv) - 1;
+              continue;
+            }
           if (!parse_member (slab + j, rv, allocator))
             {
               UNPACK_ERROR (("message '%s', field '%s': error parsing member",
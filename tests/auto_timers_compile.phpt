@@ -0,0 +1,48 @@
+--TEST--
+pinba.auto_timers=compile,autoload
+--SKIPIF--
+<?php
+if (!extension_loaded("pinba")) print "skip";
+if (PHP_VERSION_ID < 80000) print "skip autoload is timed since PHP 8.0";
+?>
+--INI--
+pinba.auto_timers=compile,autoload
+opcache.enable_cli=0
+--FILE--
+<?php
+$file = __DIR__ . "/auto_timers_compile.inc";
+$code = "<?php class AutoTimersCompile { const X = 1; }\n";
+file_put_contents($file, $code);
+
+spl_autoload_register(function ($class) use ($file) {
+	require $file;
+});
+var_dump(AutoTimersCompile::X);
+$eval = "return 2;";
+var_dump(eval($eval));
+
+$bytes = filesize(__FILE__) + strlen($code) + strlen($eval);
+$lines = array();
+foreach (pinba_decode(pinba_get_data())["timers"] as $timer) {
+	ksort($timer["tags"]);
+	$line = json_encode($timer["tags"]) . " " . $timer["hit_count"];
+	if (isset($timer["tags"]["counter"])) {
+		$line .= $timer["counter"] == $bytes ? " all bytes" : " " . $timer["counter"];
+		$line .= " value=" . $timer["value"];
+	}
+	$lines[] = $line;
+}
+sort($lines);
+echo implode("\n", $lines), "\n";
+?>
+--CLEAN--
+<?php
+@unlink(__DIR__ . "/auto_timers_compile.inc");
+?>
+--EXPECT--
+int(1)
+int(2)
+{"counter":"bytes","group":"compile"} 3 all bytes value=0
+{"group":"autoload"} 1
+{"group":"compile","op":"eval"} 1
+{"group":"compile","op":"file"} 2
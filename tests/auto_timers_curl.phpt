@@ -0,0 +1,49 @@
+--TEST--
+pinba.auto_timers=curl
+--SKIPIF--
+<?php
+if (!extension_loaded("pinba")) print "skip";
+if (!extension_loaded("curl")) print "skip curl is not available";
+if (PHP_VERSION_ID < 80200) print "skip internal functions are observed since PHP 8.2";
+?>
+--INI--
+pinba.auto_timers=curl
+--FILE--
+<?php
+$url = "file://" . __FILE__;
+
+$ch = curl_init($url);
+curl_setopt($ch, CURLOPT_RETURNTRANSFER, true);
+var_dump(strlen(curl_exec($ch)) > 0);
+
+$mh = curl_multi_init();
+$handles = array();
+for ($i = 0; $i < 2; $i++) {
+	$handles[$i] = curl_init($url);
+	curl_setopt($handles[$i], CURLOPT_RETURNTRANSFER, true);
+	curl_multi_add_handle($mh, $handles[$i]);
+}
+do {
+	curl_multi_exec($mh, $running);
+	if ($running) {
+		curl_multi_select($mh, 0.1);
+	}
+} while ($running);
+foreach ($handles as $h) {
+	curl_multi_remove_handle($mh, $h);
+}
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $timer) {
+	ksort($timer["tags"]);
+	if (isset($timer["tags"]["op"])) {
+		echo json_encode($timer["tags"]), " ", $timer["hit_count"] > 0 ? "hits" : "no hits", "\n";
+	} else {
+		echo json_encode($timer["tags"]), " ", $timer["hit_count"], "\n";
+	}
+}
+?>
+--EXPECT--
+bool(true)
+{"group":"curl","status":"0"} 3
+{"group":"curl","op":"multi"} hits
@@ -0,0 +1,29 @@
+--TEST--
+pinba.auto_timers=gc, the collected counter is not limited by pinba.max_timers
+--SKIPIF--
+<?php
+if (!extension_loaded("pinba")) print "skip";
+if (PHP_VERSION_ID < 70300) print "skip the roots buffer size is available since PHP 7.3";
+?>
+--INI--
+pinba.auto_timers=gc
+pinba.max_timers=1
+zend.enable_gc=1
+--FILE--
+<?php
+for ($i = 0; $i < 100; $i++) {
+	$o = new stdClass;
+	$o->self = $o;
+}
+unset($o);
+var_dump(gc_collect_cycles());
+
+foreach (pinba_decode(pinba_get_data())["timers"] as $timer) {
+	ksort($timer["tags"]);
+	echo implode(",", array_keys($timer["tags"])), " ", $timer["tags"]["group"], " ", $timer["hit_count"], " ", $timer["counter"], isset($timer["tags"]["counter"]) ? " value=" . $timer["value"] : "", "\n";
+}
+?>
+--EXPECT--
+int(100)
+group,roots gc 1 0
+counter,group gc 1 100 value=0
@@ -0,0 +1,37 @@
+--TEST--
+pinba.auto_timers=pdo
+--SKIPIF--
+<?php
+if (!extension_loaded("pinba")) print "skip";
+if (!extension_loaded("pdo_sqlite")) print "skip pdo_sqlite is not available";
+if (PHP_VERSION_ID < 80200) print "skip internal functions are observed since PHP 8.2";
+?>
+--INI--
+pinba.auto_timers=pdo
+--FILE--
+<?php
+$db = new PDO("sqlite::memory:");
+$db->exec("CREATE TABLE t (id INTEGER)");
+$stmt = $db->prepare("INSERT INTO t VALUES (?)");
+for ($i = 0; $i < 3; $i++) {
+	$stmt->execute(array($i));
+}
+var_dump(count($db->query("SELECT * FROM t")->fetchAll()));
+
+// no PinbaTimer objects are involved
+var_dump(count(pinba_timers_get()));
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $timer) {
+	ksort($timer["tags"]);
+	echo json_encode($timer["tags"]), " ", $timer["hit_count"], "\n";
+}
+?>
+--EXPECT--
+int(3)
+int(0)
+{"group":"db","op":"connect"} 1
+{"group":"db","op":"exec"} 1
+{"group":"db","op":"prepare"} 1
+{"group":"db","op":"execute"} 3
+{"group":"db","op":"query"} 1
@@ -0,0 +1,39 @@
+--TEST--
+the packet dictionary has only the words the packet refers to
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$t = pinba_timer_start(array("group" => "gone"));
+pinba_timer_stop($t);
+pinba_timer_delete($t);
+
+$t = pinba_timer_start(array("group" => "old", "step" => "first"));
+pinba_timer_stop($t);
+pinba_timer_tags_replace($t, array("group" => "db"));
+pinba_tag_set("server", "web1");
+
+$packet = pinba_decode(pinba_get_data());
+sort($packet["dictionary"]);
+var_dump($packet["dictionary"]);
+var_dump($packet["tags"], $packet["timers"][0]["tags"]);
+?>
+--EXPECT--
+array(4) {
+  [0]=>
+  string(2) "db"
+  [1]=>
+  string(5) "group"
+  [2]=>
+  string(6) "server"
+  [3]=>
+  string(4) "web1"
+}
+array(1) {
+  ["server"]=>
+  string(4) "web1"
+}
+array(1) {
+  ["group"]=>
+  string(2) "db"
+}
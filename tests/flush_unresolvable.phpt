@@ -0,0 +1,26 @@
+--TEST--
+pinba_flush() to a server that does not resolve, then dropping the timer
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--INI--
+pinba.enabled=1
+pinba.server=pinba.invalid:30002
+pinba.auto_flush=0
+--FILE--
+<?php
+$t = pinba_timer_start(array("name" => "lost"));
+var_dump(@pinba_flush());
+unset($t);
+
+$t = pinba_timer_start(array("name" => "next"));
+pinba_timer_stop($t);
+unset($t);
+var_dump(@pinba_flush());
+
+$packet = pinba_decode(pinba_get_data());
+var_dump(count($packet["timers"]));
+?>
+--EXPECT--
+bool(true)
+bool(true)
+int(0)
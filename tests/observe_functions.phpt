@@ -0,0 +1,40 @@
+--TEST--
+pinba.observe_functions
+--SKIPIF--
+<?php
+if (!extension_loaded("pinba")) print "skip";
+if (PHP_VERSION_ID < 80000) print "skip the observer API is available since PHP 8.0";
+?>
+--INI--
+pinba.observe_functions=Repo::*, \render
+--FILE--
+<?php
+class Repo {
+	function load($id) { return $id; }
+	static function save($id) { return $id; }
+}
+class Other {
+	function load($id) { return $id; }
+}
+function render($s) { return $s; }
+function skipped($s) { return $s; }
+
+$repo = new Repo;
+$other = new Other;
+for ($i = 0; $i < 5; $i++) {
+	$repo->load($i);
+	$other->load($i);
+	skipped($i);
+}
+Repo::save(1);
+RENDER("x");
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $timer) {
+	echo json_encode($timer["tags"]), " ", $timer["hit_count"], "\n";
+}
+?>
+--EXPECT--
+{"function":"Repo::load","group":"function"} 5
+{"function":"Repo::save","group":"function"} 1
+{"function":"render","group":"function"} 1
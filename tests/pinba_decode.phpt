@@ -0,0 +1,45 @@
+--TEST--
+pinba_decode() round trip
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+pinba_tag_set("tag", "value");
+pinba_timer_add(array("group" => "db", "op" => "select"), 1.5);
+pinba_timer_add(array("group" => "db", "op" => "select"), 0.5, array(), 2);
+pinba_timer_add(array("group" => "cache"), 0.25);
+
+$packet = pinba_decode(pinba_get_data());
+
+var_dump($packet["tags"]);
+foreach ($packet["timers"] as $timer) {
+	ksort($timer["tags"]);
+	var_dump($timer["tags"], $timer["value"], $timer["hit_count"]);
+}
+var_dump(count($packet["requests"]));
+
+var_dump(pinba_decode("\xff\xff\xff"));
+?>
+--EXPECTF--
+array(1) {
+  ["tag"]=>
+  string(5) "value"
+}
+array(2) {
+  ["group"]=>
+  string(2) "db"
+  ["op"]=>
+  string(6) "select"
+}
+float(2)
+int(3)
+array(1) {
+  ["group"]=>
+  string(5) "cache"
+}
+float(0.25)
+int(1)
+int(0)
+
+Warning: pinba_decode(): failed to decode Pinba packet in %s on line %d
+bool(false)
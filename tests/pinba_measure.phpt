@@ -0,0 +1,39 @@
+--TEST--
+pinba_measure()
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+function work($a, $b) {
+	return $a + $b;
+}
+
+for ($i = 0; $i < 3; $i++) {
+	$r = pinba_measure(array("group" => "work"), "work", $i, 10);
+}
+var_dump($r);
+
+$tags = array("group" => "fail");
+try {
+	pinba_measure($tags, function () { throw new Exception("oops"); });
+} catch (Exception $e) {
+	echo $e->getMessage(), "\n";
+}
+
+var_dump(pinba_measure(array(), "work", 1, 2));
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $timer) {
+	var_dump($timer["tags"]["group"], $timer["hit_count"]);
+}
+?>
+--EXPECTF--
+int(12)
+oops
+
+Warning: pinba_measure(): tags array cannot be empty in %s on line %d
+bool(false)
+string(4) "work"
+int(3)
+string(4) "fail"
+int(1)
@@ -0,0 +1,30 @@
+--TEST--
+pinba_measure() with pinba.timer_nesting under different parents
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--INI--
+pinba.timer_nesting=1
+--FILE--
+<?php
+$a = pinba_timer_start(array("name" => "a"));
+pinba_measure(array("name" => "work"), "usleep", 1000);
+pinba_timer_stop($a);
+
+// the measure timer stays under "a", so "b" keeps the time as its own
+$b = pinba_timer_start(array("name" => "b"));
+pinba_measure(array("name" => "work"), "usleep", 1000);
+pinba_timer_stop($b);
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $i => $timer) {
+	echo $i, " ", $timer["tags"]["name"], " parent=", var_export($timer["parent"], true), " hits=", $timer["hit_count"], "\n";
+	if ($timer["tags"]["name"] === "b") {
+		var_dump($timer["self_value"] == $timer["value"]);
+	}
+}
+?>
+--EXPECT--
+0 a parent=NULL hits=1
+1 work parent=0 hits=2
+2 b parent=NULL hits=1
+bool(true)
@@ -0,0 +1,26 @@
+--TEST--
+pinba_measure() timers left to the flush at request shutdown
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--INI--
+pinba.enabled=1
+pinba.server=127.0.0.1:30002
+pinba.timer_nesting=1
+--FILE--
+<?php
+function work($a) {
+	return $a * 2;
+}
+
+var_dump(pinba_measure(array("group" => "work"), "work", 1));
+
+// the measure timer holds the last reference to its parent
+$outer = pinba_timer_start(array("group" => "outer"));
+pinba_measure(array("group" => "inner"), "work", 2);
+pinba_timer_stop($outer);
+unset($outer);
+echo "done\n";
+?>
+--EXPECT--
+int(2)
+done
@@ -0,0 +1,41 @@
+--TEST--
+pinba.sketches and pinba_sketch_merge()/pinba_sketch_quantile()
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--INI--
+pinba.sketches=1
+--FILE--
+<?php
+for ($i = 0; $i < 999; $i++) {
+	pinba_timer_add(array("name" => "db"), 0.01);
+}
+pinba_timer_add(array("name" => "db"), 2.0);
+
+$packet = pinba_decode(pinba_get_data());
+$sketch = $packet["timers"][0]["sketch"];
+var_dump(is_string($packet["request_time_sketch"]));
+var_dump(abs(pinba_sketch_quantile($sketch, 0.5) - 0.01) <= 0.01 * 0.01);
+var_dump(abs(pinba_sketch_quantile($sketch, 0.999) - 0.01) <= 0.01 * 0.01);
+var_dump(pinba_sketch_quantile($sketch, 1));
+
+$merged = pinba_sketch_merge($sketch, $sketch, $packet["request_time_sketch"]);
+var_dump(abs(pinba_sketch_quantile($merged, 0.9995) - 2.0) <= 2.0 * 0.01);
+
+var_dump(pinba_sketch_quantile("garbage", 0.5));
+var_dump(pinba_sketch_quantile($sketch, 1.5));
+var_dump(pinba_sketch_merge($sketch, "garbage"));
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+bool(true)
+float(2)
+
+Warning: pinba_sketch_quantile(): argument #1 is not a valid sketch in %s on line %d
+bool(false)
+
+Warning: pinba_sketch_quantile(): quantile must be between 0 and 1 in %s on line %d
+bool(false)
+
+Warning: pinba_sketch_merge(): argument #2 is not a valid sketch in %s on line %d
+bool(false)
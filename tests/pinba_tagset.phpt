@@ -0,0 +1,65 @@
+--TEST--
+pinba_tagset_create() and PinbaTagSet tags for timers
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$tags = array("op" => "select", "group" => "db", "shard" => 3);
+$set = pinba_tagset_create($tags);
+var_dump(get_class($set));
+// the set is sorted by name, the array is left alone
+var_dump($set->getTags());
+var_dump(array_keys($tags));
+
+$t = pinba_timer_start($set);
+pinba_timer_stop($t);
+PinbaTimer::add($set, 0.5);
+pinba_measure($set, function () {});
+var_dump(pinba_timer_get_info($t)["tags"] == pinba_tagset_get_tags($set));
+
+$client = new PinbaClient(array("127.0.0.1"));
+var_dump($client->addTimer($set, 0.1));
+var_dump($client->addTimer($tags, 0.1));
+
+// the same tags from an array and from a set end up in one timer
+$packet = pinba_decode(pinba_get_data());
+var_dump(count($packet["timers"]), $packet["timers"][0]["hit_count"]);
+
+var_dump(pinba_timer_start("db"));
+var_dump(pinba_tagset_create(array()));
+try {
+	new PinbaTagSet();
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+?>
+--EXPECTF--
+string(11) "PinbaTagSet"
+array(3) {
+  ["group"]=>
+  string(2) "db"
+  ["op"]=>
+  string(6) "select"
+  ["shard"]=>
+  string(1) "3"
+}
+array(3) {
+  [0]=>
+  string(2) "op"
+  [1]=>
+  string(5) "group"
+  [2]=>
+  string(5) "shard"
+}
+bool(true)
+bool(true)
+bool(true)
+int(1)
+int(3)
+
+Warning: pinba_timer_start(): tags must be an array or a PinbaTagSet, string given in %s on line %d
+bool(false)
+
+Warning: pinba_tagset_create(): tags array cannot be empty in %s on line %d
+bool(false)
+Cannot directly construct PinbaTagSet, use pinba_tagset_create() instead
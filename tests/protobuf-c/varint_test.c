@@ -0,0 +1,177 @@
+/*
+ * Checks that the batch packers for repeated 32-bit fields produce
+ * exactly the same bytes as packing every element through
+ * required_field_pack(), and that the batch decoder restores them.
+ */
+
+/* pull in the static helpers under test */
+#include "protobuf-c.c"
+#include "pinba.pb-c.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_ELEMENTS 4096
+
+static unsigned failures;
+
+#define CHECK(cond, ...) do {                         \
+	if (!(cond)) {                                    \
+		fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__);                 \
+		fputc('\n', stderr);                          \
+		failures++;                                   \
+	}                                                 \
+} while (0)
+
+static uint32_t rng_state = 2463534242U;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static const uint32_t edges[] = {
+	0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0x1fffff, 0x200000,
+	0xfffffff, 0x10000000, 0x7fffffff, 0x80000000, 0xffffffff
+};
+
+/* fill values with a given distribution of varint lengths */
+static void fill(uint32_t *values, size_t n, int kind)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		switch (kind) {
+			case 0: /* typical dictionary ids */
+				values[i] = rng() & 0x7f;
+				break;
+			case 1: /* mixed 1-3 bytes */
+				values[i] = rng() >> (rng() % 32 + 11);
+				break;
+			case 2: /* full range */
+				values[i] = rng();
+				break;
+			default: /* boundary values */
+				values[i] = edges[i % (sizeof(edges) / sizeof(edges[0]))];
+				break;
+		}
+	}
+}
+
+typedef struct {
+	ProtobufCBuffer base;
+	uint8_t *data;
+	size_t len;
+	unsigned appends;
+} TestBuffer;
+
+static void test_buffer_append(ProtobufCBuffer *buffer, size_t len, const uint8_t *data)
+{
+	TestBuffer *tb = (TestBuffer *)buffer;
+
+	memcpy(tb->data + tb->len, data, len);
+	tb->len += len;
+	tb->appends++;
+}
+
+static void check_field(ProtobufCType type, unsigned id, const uint32_t *values, size_t n)
+{
+	static uint8_t expected[MAX_ELEMENTS * 20], packed[MAX_ELEMENTS * 20], buffered[MAX_ELEMENTS * 20];
+	ProtobufCFieldDescriptor field;
+	TestBuffer tb;
+	size_t expected_len = 0, packed_len, size, i;
+	const uint32_t *member = values;
+
+	memset(&field, 0, sizeof(field));
+	field.name = "test";
+	field.id = id;
+	field.label = PROTOBUF_C_LABEL_REPEATED;
+	field.type = type;
+
+	for (i = 0; i < n; i++) {
+		expected_len += required_field_pack(&field, values + i, expected + expected_len);
+	}
+
+	packed_len = repeated_field_pack(&field, n, &member, packed);
+	CHECK(packed_len == expected_len, "type %d id %u n %zu: pack length %zu, expected %zu", type, id, n, packed_len, expected_len);
+	CHECK(memcmp(packed, expected, expected_len) == 0, "type %d id %u n %zu: pack bytes differ", type, id, n);
+
+	size = repeated_field_get_packed_size(&field, n, &member);
+	CHECK(size == expected_len, "type %d id %u n %zu: packed size %zu, expected %zu", type, id, n, size, expected_len);
+
+	memset(&tb, 0, sizeof(tb));
+	tb.base.append = test_buffer_append;
+	tb.data = buffered;
+	packed_len = repeated_field_pack_to_buffer(&field, n, &member, &tb.base);
+	CHECK(packed_len == expected_len && tb.len == expected_len, "type %d id %u n %zu: pack_to_buffer length %zu, expected %zu", type, id, n, tb.len, expected_len);
+	CHECK(memcmp(buffered, expected, expected_len) == 0, "type %d id %u n %zu: pack_to_buffer bytes differ", type, id, n);
+}
+
+static void check_roundtrip(const uint32_t *values, size_t n)
+{
+	Pinba__Request request = PINBA__REQUEST__INIT, *decoded;
+	uint32_t *counts = calloc(n + 1, sizeof(uint32_t));
+	uint8_t *data;
+	size_t len, i;
+
+	/* two adjacent repeated uint32 fields, so that runs end on a field change */
+	request.hostname = "host";
+	request.server_name = "server";
+	request.script_name = "script";
+	request.n_timer_hit_count = n;
+	request.timer_hit_count = (uint32_t *)values;
+	request.n_timer_tag_count = n;
+	request.timer_tag_count = counts;
+	for (i = 0; i < n; i++) {
+		counts[i] = values[n - i - 1];
+	}
+
+	len = pinba__request__get_packed_size(&request);
+	data = malloc(len);
+	CHECK(pinba__request__pack(&request, data) == len, "roundtrip n %zu: pack length", n);
+
+	decoded = pinba__request__unpack(NULL, len, data);
+	CHECK(decoded != NULL, "roundtrip n %zu: unpack failed", n);
+	if (decoded) {
+		CHECK(decoded->n_timer_hit_count == n && decoded->n_timer_tag_count == n, "roundtrip n %zu: element counts", n);
+		CHECK(n == 0 || memcmp(decoded->timer_hit_count, values, n * sizeof(uint32_t)) == 0, "roundtrip n %zu: hit counts differ", n);
+		CHECK(n == 0 || memcmp(decoded->timer_tag_count, counts, n * sizeof(uint32_t)) == 0, "roundtrip n %zu: tag counts differ", n);
+		pinba__request__free_unpacked(decoded, NULL);
+	}
+
+	free(data);
+	free(counts);
+}
+
+int main(void)
+{
+	static const size_t sizes[] = { 0, 1, 2, 127, 128, 129, 255, 1000, MAX_ELEMENTS };
+	static const unsigned ids[] = { 1, 15, 16, 2047, 2048, 262143, 536870911 };
+	static uint32_t values[MAX_ELEMENTS];
+	size_t s, i;
+	int kind;
+
+	for (kind = 0; kind < 4; kind++) {
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			fill(values, sizes[s], kind);
+			for (i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+				check_field(PROTOBUF_C_TYPE_UINT32, ids[i], values, sizes[s]);
+				check_field(PROTOBUF_C_TYPE_ENUM, ids[i], values, sizes[s]);
+				check_field(PROTOBUF_C_TYPE_FIXED32, ids[i], values, sizes[s]);
+				check_field(PROTOBUF_C_TYPE_FLOAT, ids[i], values, sizes[s]);
+			}
+			check_roundtrip(values, sizes[s]);
+		}
+	}
+
+	if (failures) {
+		fprintf(stderr, "%u check(s) failed\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
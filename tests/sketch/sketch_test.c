@@ -0,0 +1,282 @@
+/*
+ * Checks the relative error bound of pinba_sketch quantiles against the
+ * exact quantiles of several distributions, that merging is associative
+ * and equivalent to adding all values to one sketch, and that sketches
+ * survive serialization.
+ */
+
+#include "pinba_sketch.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N_VALUES 100000
+
+static unsigned failures;
+
+#define CHECK(cond, ...) do {                         \
+	if (!(cond)) {                                    \
+		fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); \
+		fprintf(stderr, __VA_ARGS__);                 \
+		fputc('\n', stderr);                          \
+		failures++;                                   \
+	}                                                 \
+} while (0)
+
+static uint32_t rng_state = 2463534242U;
+
+static uint32_t rng(void)
+{
+	rng_state ^= rng_state << 13;
+	rng_state ^= rng_state >> 17;
+	rng_state ^= rng_state << 5;
+	return rng_state;
+}
+
+static double uniform(void)
+{
+	return (rng() + 0.5) / 4294967296.0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* kind 0: uniform, 1: exponential, 2: pareto (heavy tail), 3: log-uniform over 1ns..1000s */
+static void fill(double *values, size_t n, int kind)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		switch (kind) {
+			case 0:
+				values[i] = uniform();
+				break;
+			case 1:
+				values[i] = -log(uniform()) * 0.01;
+				break;
+			case 2:
+				values[i] = 0.001 / pow(uniform(), 1 / 1.2);
+				break;
+			default:
+				values[i] = 1e-9 * pow(10, 12 * uniform());
+				break;
+		}
+	}
+}
+
+static void check_quantiles(const pinba_sketch *sketch, double *values, size_t n, const char *what)
+{
+	static const double qs[] = { 0, 0.01, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999, 1 };
+	double *sorted = malloc(n * sizeof(double));
+	size_t i;
+
+	memcpy(sorted, values, n * sizeof(double));
+	qsort(sorted, n, sizeof(double), cmp_double);
+
+	for (i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+		double exact = sorted[(size_t)(qs[i] * (n - 1))];
+		double got = pinba_sketch_quantile(sketch, qs[i]);
+
+		/* values below a full window are collapsed into its lowest bin, only high quantiles are kept */
+		if (sketch->n_bins == PINBA_SKETCH_MAX_BINS && exact <= exp(sketch->offset * sketch->gamma_ln) && qs[i] > 0) {
+			continue;
+		}
+		CHECK(fabs(got - exact) <= exact * sketch->alpha * (1 + 1e-9),
+				"%s: q %g exact %.9g got %.9g", what, qs[i], exact, got);
+	}
+	free(sorted);
+}
+
+static void check_error_bound(double *values, size_t n, int kind, double alpha)
+{
+	pinba_sketch sketch;
+	char what[64];
+	size_t i;
+
+	snprintf(what, sizeof(what), "kind %d alpha %g", kind, alpha);
+	CHECK(pinba_sketch_init(&sketch, alpha) == 0, "%s: init", what);
+	for (i = 0; i < n; i++) {
+		pinba_sketch_add(&sketch, values[i], 1);
+	}
+	CHECK(sketch.count == n, "%s: count %llu", what, (unsigned long long)sketch.count);
+	check_quantiles(&sketch, values, n, what);
+	pinba_sketch_destroy(&sketch);
+}
+
+static int same_bins(const pinba_sketch *a, const pinba_sketch *b)
+{
+	uint32_t i;
+	int64_t key;
+
+	if (a->count != b->count || a->zero_count != b->zero_count || a->min != b->min || a->max != b->max) {
+		return 0;
+	}
+	for (i = 0; i < a->n_bins; i++) {
+		key = (int64_t)a->offset + i;
+		if (a->bins[i] && (key < b->offset || key >= (int64_t)b->offset + b->n_bins || b->bins[key - b->offset] != a->bins[i])) {
+			return 0;
+		}
+	}
+	for (i = 0; i < b->n_bins; i++) {
+		key = (int64_t)b->offset + i;
+		if (b->bins[i] && (key < a->offset || key >= (int64_t)a->offset + a->n_bins || a->bins[key - a->offset] != b->bins[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void check_merge(double *values, size_t n, int kind)
+{
+	pinba_sketch all, parts[3], left, right, other;
+	size_t i;
+
+	pinba_sketch_init(&all, PINBA_SKETCH_DEFAULT_ALPHA);
+	for (i = 0; i < 3; i++) {
+		pinba_sketch_init(&parts[i], PINBA_SKETCH_DEFAULT_ALPHA);
+	}
+	for (i = 0; i < n; i++) {
+		pinba_sketch_add(&all, values[i], 1);
+		/* uneven split, so that the parts cover different ranges */
+		pinba_sketch_add(&parts[values[i] < values[n / 2] ? 0 : (i % 7 ? 1 : 2)], values[i], 1);
+	}
+
+	/* (a + b) + c */
+	pinba_sketch_init(&left, PINBA_SKETCH_DEFAULT_ALPHA);
+	CHECK(pinba_sketch_merge(&left, &parts[0]) == 0, "kind %d: merge", kind);
+	pinba_sketch_merge(&left, &parts[1]);
+	pinba_sketch_merge(&left, &parts[2]);
+
+	/* a + (b + c) */
+	pinba_sketch_init(&right, PINBA_SKETCH_DEFAULT_ALPHA);
+	pinba_sketch_merge(&right, &parts[1]);
+	pinba_sketch_merge(&right, &parts[2]);
+	pinba_sketch_merge(&parts[0], &right);
+
+	CHECK(same_bins(&left, &all), "kind %d: merged sketch differs from a single one", kind);
+	CHECK(same_bins(&parts[0], &left), "kind %d: merge is not associative", kind);
+	check_quantiles(&left, values, n, "merged");
+
+	pinba_sketch_init(&other, 0.02);
+	CHECK(pinba_sketch_merge(&other, &all) == -1, "kind %d: merged sketches of different accuracy", kind);
+
+	pinba_sketch_destroy(&all);
+	pinba_sketch_destroy(&left);
+	pinba_sketch_destroy(&right);
+	pinba_sketch_destroy(&other);
+	for (i = 0; i < 3; i++) {
+		pinba_sketch_destroy(&parts[i]);
+	}
+}
+
+static void check_serialize(double *values, size_t n, int kind)
+{
+	pinba_sketch sketch, copy;
+	uint8_t *data, *again;
+	size_t len, i;
+
+	pinba_sketch_init(&sketch, PINBA_SKETCH_DEFAULT_ALPHA);
+	for (i = 0; i < n; i++) {
+		pinba_sketch_add(&sketch, values[i], 1 + i % 3);
+	}
+
+	len = pinba_sketch_serialized_size(&sketch);
+	data = malloc(len);
+	CHECK(pinba_sketch_serialize(&sketch, data) == len, "kind %d n %zu: serialized size", kind, n);
+
+	CHECK(pinba_sketch_unserialize(&copy, data, len) == 0, "kind %d n %zu: unserialize failed", kind, n);
+	CHECK(same_bins(&sketch, &copy) && sketch.sum == copy.sum && sketch.alpha == copy.alpha,
+			"kind %d n %zu: unserialized sketch differs", kind, n);
+
+	again = malloc(len);
+	CHECK(pinba_sketch_serialized_size(&copy) == len && pinba_sketch_serialize(&copy, again) == len
+			&& memcmp(data, again, len) == 0, "kind %d n %zu: serialization is not stable", kind, n);
+	pinba_sketch_destroy(&copy);
+
+	for (i = 0; i < len; i++) {
+		if (pinba_sketch_unserialize(&copy, data, i) == 0) {
+			CHECK(0, "kind %d n %zu: unserialized a truncated sketch of %zu bytes", kind, n, i);
+			pinba_sketch_destroy(&copy);
+		}
+	}
+
+	free(again);
+	free(data);
+	pinba_sketch_destroy(&sketch);
+}
+
+static void check_collapse(void)
+{
+	pinba_sketch sketch;
+	double *values = malloc(N_VALUES * sizeof(double));
+	double *sorted = malloc(N_VALUES * sizeof(double));
+	static const double qs[] = { 0.9, 0.99, 0.999 };
+	size_t i;
+
+	/* 1ns to 30 years does not fit the bins window */
+	pinba_sketch_init(&sketch, PINBA_SKETCH_DEFAULT_ALPHA);
+	for (i = 0; i < N_VALUES; i++) {
+		values[i] = 1e-9 * pow(10, 18 * uniform());
+		pinba_sketch_add(&sketch, values[i], 1);
+	}
+	CHECK(sketch.n_bins <= PINBA_SKETCH_MAX_BINS, "collapse: %u bins", sketch.n_bins);
+
+	memcpy(sorted, values, N_VALUES * sizeof(double));
+	qsort(sorted, N_VALUES, sizeof(double), cmp_double);
+	for (i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+		double exact = sorted[(size_t)(qs[i] * (N_VALUES - 1))];
+		double got = pinba_sketch_quantile(&sketch, qs[i]);
+
+		CHECK(fabs(got - exact) <= exact * sketch.alpha * (1 + 1e-9), "collapse: q %g exact %.9g got %.9g", qs[i], exact, got);
+	}
+
+	free(sorted);
+	free(values);
+	pinba_sketch_destroy(&sketch);
+}
+
+int main(void)
+{
+	static const size_t sizes[] = { 0, 1, 2, 100, N_VALUES };
+	static const double alphas[] = { 0.001, 0.01, 0.05 };
+	double *values = malloc(N_VALUES * sizeof(double));
+	pinba_sketch sketch;
+	size_t s, i;
+	int kind;
+
+	CHECK(pinba_sketch_init(&sketch, 0) == -1, "init accepted alpha 0");
+	CHECK(pinba_sketch_init(&sketch, 1) == -1, "init accepted alpha 1");
+
+	pinba_sketch_init(&sketch, PINBA_SKETCH_DEFAULT_ALPHA);
+	CHECK(pinba_sketch_quantile(&sketch, 0.5) == 0, "empty sketch quantile");
+	pinba_sketch_add(&sketch, 0, 3);
+	pinba_sketch_add(&sketch, 1, 1);
+	CHECK(pinba_sketch_quantile(&sketch, 0.5) == 0 && pinba_sketch_quantile(&sketch, 1) == 1, "zero values");
+	pinba_sketch_destroy(&sketch);
+
+	for (kind = 0; kind < 4; kind++) {
+		fill(values, N_VALUES, kind);
+		for (i = 0; i < sizeof(alphas) / sizeof(alphas[0]); i++) {
+			check_error_bound(values, N_VALUES, kind, alphas[i]);
+		}
+		check_merge(values, N_VALUES, kind);
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+			check_serialize(values, sizes[s], kind);
+		}
+	}
+	check_collapse();
+
+	free(values);
+	if (failures) {
+		fprintf(stderr, "%u check(s) failed\n", failures);
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
@@ -0,0 +1,25 @@
+--TEST--
+pinba_timer_start() options
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$t = pinba_timer_start(array("a" => "b"), NULL, 1, array("cpu" => false));
+for ($i = 0; $i < 100000; $i++);
+pinba_timer_stop($t);
+$info = pinba_timer_get_info($t);
+var_dump($info["ru_utime"], $info["ru_stime"]);
+
+var_dump(pinba_timer_start(array("a" => "b"), NULL, 1, array("nope" => 1)));
+
+$t = pinba_timer_start(array("a" => "b"), "not an array");
+var_dump($t instanceof PinbaTimer, pinba_timer_get_info($t)["data"]);
+?>
+--EXPECTF--
+float(0)
+float(0)
+
+Warning: pinba_timer_start(): unknown timer option 'nope' in %s on line %d
+bool(false)
+bool(true)
+NULL
@@ -0,0 +1,35 @@
+--TEST--
+Stopped timers dropped by the script are folded, pinba.max_timers
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--INI--
+pinba.max_timers=2
+--FILE--
+<?php
+for ($i = 0; $i < 1000; $i++) {
+	pinba_timer_add(array("name" => "db"), 0.001);
+	pinba_timer_stop(pinba_timer_start(array("name" => "cache")));
+}
+var_dump(count(pinba_timers_get()));
+
+// kept by the script, not folded
+$kept = pinba_timer_add(array("name" => "db"), 0.5);
+
+for ($i = 0; $i < 3; $i++) {
+	pinba_timer_add(array("name" => "other" . $i), 0.25);
+}
+
+$info = pinba_get_info();
+echo count($info["timers"]), "\n";
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $timer) {
+	echo json_encode($timer["tags"]), " ", $timer["hit_count"], " ", round($timer["value"], 3), "\n";
+}
+?>
+--EXPECT--
+int(0)
+4
+{"name":"db"} 1001 1.5
+{"name":"cache"} 1000 0
+{"__overflow__":"1"} 3 0.75
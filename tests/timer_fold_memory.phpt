@@ -0,0 +1,38 @@
+--TEST--
+Timers started and dropped in a loop under a running timer keep memory flat
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$outer = pinba_timer_start(array("name" => "request"));
+
+function loop($n) {
+	for ($i = 0; $i < $n; $i++) {
+		pinba_timer_stop(pinba_timer_start(array("name" => "db", "op" => $i % 4)));
+		pinba_measure(array("name" => "cache"), "strlen", "x");
+	}
+}
+
+loop(1000);
+$before = memory_get_usage();
+loop(20000);
+var_dump(memory_get_usage() - $before < 4096);
+
+pinba_timer_stop($outer);
+$hits = array();
+foreach (pinba_decode(pinba_get_data())["timers"] as $timer) {
+	$hits[$timer["tags"]["name"]] = (isset($hits[$timer["tags"]["name"]]) ? $hits[$timer["tags"]["name"]] : 0) + $timer["hit_count"];
+}
+ksort($hits);
+var_dump($hits);
+?>
+--EXPECT--
+bool(true)
+array(3) {
+  ["cache"]=>
+  int(21000)
+  ["db"]=>
+  int(21000)
+  ["request"]=>
+  int(1)
+}
@@ -0,0 +1,27 @@
+--TEST--
+pinba.timer_histograms
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--INI--
+pinba.timer_histograms=1
+--FILE--
+<?php
+for ($i = 0; $i < 200; $i++) {
+	pinba_timer_add(array("name" => "db"), 0.0001);
+}
+pinba_timer_add(array("name" => "db"), 0.8);
+
+$packet = pinba_decode(pinba_get_data());
+$timer = $packet["timers"][0];
+var_dump($timer["hit_count"]);
+var_dump(array_sum($timer["histogram"]));
+var_dump(count($timer["histogram"]));
+var_dump(round($timer["min_value"], 4));
+var_dump(round($timer["max_value"], 1));
+?>
+--EXPECT--
+int(201)
+int(201)
+int(2)
+float(0.0001)
+float(0.8)
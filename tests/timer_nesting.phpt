@@ -0,0 +1,39 @@
+--TEST--
+pinba.timer_nesting
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--INI--
+pinba.timer_nesting=1
+--FILE--
+<?php
+$controller = pinba_timer_start(array("name" => "controller"));
+for ($i = 0; $i < 2; $i++) {
+	$db = pinba_timer_start(array("name" => "db"));
+	usleep(1000);
+	pinba_timer_stop($db);
+}
+pinba_timer_add(array("name" => "cache"), 10);
+pinba_timer_stop($controller);
+
+$top = pinba_timer_start(array("name" => "other"));
+pinba_timer_stop($top);
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $i => $timer) {
+	echo $i, " ", $timer["tags"]["name"], " parent=", var_export($timer["parent"], true), " hits=", $timer["hit_count"], "\n";
+	if ($timer["tags"]["name"] === "db") {
+		var_dump($timer["self_value"] == $timer["value"]);
+	}
+	if ($timer["tags"]["name"] === "controller") {
+		// the added cache timer is longer than the controller itself
+		var_dump($timer["self_value"]);
+	}
+}
+?>
+--EXPECT--
+0 controller parent=NULL hits=1
+float(0)
+1 db parent=0 hits=2
+bool(true)
+2 cache parent=0 hits=1
+3 other parent=NULL hits=1
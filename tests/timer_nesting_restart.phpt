@@ -0,0 +1,41 @@
+--TEST--
+pinba.timer_nesting with a timer restarted while another one is running
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--INI--
+pinba.timer_nesting=1
+--FILE--
+<?php
+$a = pinba_timer_start(array("name" => "a"));
+pinba_timer_stop($a);
+
+$b = pinba_timer_start(array("name" => "b"));
+pinba_timer_restart($a);
+pinba_timer_stop($a);
+// b is running again at the top of the stack
+$c = pinba_timer_start(array("name" => "c"));
+pinba_timer_stop($c);
+pinba_timer_stop($b);
+
+// restarted out of order while still in the stack
+$d = pinba_timer_start(array("name" => "d"));
+$e = pinba_timer_start(array("name" => "e"));
+pinba_timer_stop($d);
+pinba_timer_restart($d);
+pinba_timer_stop($e);
+pinba_timer_stop($d);
+$f = pinba_timer_start(array("name" => "f"));
+pinba_timer_stop($f);
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $i => $timer) {
+	echo $i, " ", $timer["tags"]["name"], " parent=", var_export($timer["parent"], true), " hits=", $timer["hit_count"], "\n";
+}
+?>
+--EXPECT--
+0 a parent=NULL hits=2
+1 b parent=NULL hits=1
+2 c parent=1 hits=1
+3 d parent=NULL hits=2
+4 e parent=3 hits=1
+5 f parent=NULL hits=1
@@ -0,0 +1,60 @@
+--TEST--
+PinbaTimer objects
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$t = PinbaTimer::start(array("group" => "db"), array("q" => 1));
+var_dump(get_class($t));
+$t->tagsMerge(array("op" => "select"));
+$t->dataMerge(array("r" => 2));
+var_dump($t->stop());
+$info = $t->getInfo();
+var_dump($info["started"], $info["tags"], $info["data"]);
+
+// the functions are thin wrappers around the methods
+$t2 = pinba_timer_add(array("group" => "cache"), 0.25);
+var_dump($t2 instanceof PinbaTimer, pinba_timer_get_info($t2)["value"]);
+
+// timers the script doesn't keep are folded, but still reported
+PinbaTimer::add(array("group" => "dropped"), 0.5);
+var_dump(count(pinba_timers_get()), count(pinba_get_info()["timers"]));
+
+$t2->delete();
+var_dump(count(pinba_timers_get()));
+
+try {
+	new PinbaTimer();
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+
+try {
+	clone $t;
+} catch (Error $e) {
+	echo $e->getMessage(), "\n";
+}
+?>
+--EXPECT--
+string(10) "PinbaTimer"
+bool(true)
+bool(false)
+array(2) {
+  ["group"]=>
+  string(2) "db"
+  ["op"]=>
+  string(6) "select"
+}
+array(2) {
+  ["q"]=>
+  int(1)
+  ["r"]=>
+  int(2)
+}
+bool(true)
+float(0.25)
+int(2)
+int(3)
+int(1)
+Cannot directly construct PinbaTimer, use PinbaTimer::start() or PinbaTimer::add() instead
+Trying to clone an uncloneable object of class PinbaTimer
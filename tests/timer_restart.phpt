@@ -0,0 +1,43 @@
+--TEST--
+pinba_timer_restart() and PinbaTimer::restart()
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$t = pinba_timer_start(array("name" => "batch"));
+usleep(10000);
+pinba_timer_stop($t);
+
+for ($i = 0; $i < 3; $i++) {
+	var_dump($t->restart());
+	usleep(10000);
+	$t->stop();
+}
+// four runs of at least 10ms each
+var_dump(pinba_timer_get_info($t)["value"] >= 0.04);
+
+var_dump(pinba_timer_restart($t), pinba_timer_restart($t));
+$t->stop();
+
+// restarting the timer doesn't add new timers
+var_dump(count(pinba_timers_get()));
+$packet = pinba_decode(pinba_get_data());
+var_dump($packet["timers"][0]["hit_count"]);
+
+$t->delete();
+var_dump($t->restart());
+?>
+--EXPECTF--
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+
+Notice: pinba_timer_restart(): timer is already running in %s on line %d
+bool(true)
+bool(false)
+int(1)
+int(5)
+
+Warning: PinbaTimer::restart(): timer has been deleted or already sent in %s on line %d
+bool(false)
@@ -0,0 +1,54 @@
+--TEST--
+pinba_timer_tags_merge() and pinba_timer_tags_replace()
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$tags = array("server" => "db1", "group" => "mysql", "op" => 1);
+$t = pinba_timer_start($tags);
+
+// the caller's array is left as is
+var_dump(array_keys($tags));
+
+var_dump(pinba_timer_tags_merge($t, array("op" => "select", "alpha" => 2.5, "zeta" => null)));
+$info = pinba_timer_get_info($t);
+var_dump($info["tags"]);
+
+var_dump(pinba_timer_tags_replace($t, array("b" => "2", "a" => "1")));
+$info = pinba_timer_get_info($t);
+var_dump($info["tags"]);
+
+var_dump(pinba_timer_tags_merge($t, array(1 => "numeric")));
+?>
+--EXPECTF--
+array(3) {
+  [0]=>
+  string(6) "server"
+  [1]=>
+  string(5) "group"
+  [2]=>
+  string(2) "op"
+}
+bool(true)
+array(5) {
+  ["alpha"]=>
+  string(3) "2.5"
+  ["group"]=>
+  string(5) "mysql"
+  ["op"]=>
+  string(6) "select"
+  ["server"]=>
+  string(3) "db1"
+  ["zeta"]=>
+  string(0) ""
+}
+bool(true)
+array(2) {
+  ["a"]=>
+  string(1) "1"
+  ["b"]=>
+  string(1) "2"
+}
+
+Warning: pinba_timer_tags_merge(): tags can only have string names (i.e. tags array cannot contain numeric indexes) in %s on line %d
+bool(false)
@@ -0,0 +1,29 @@
+--TEST--
+retagging a running timer in a loop does not grow memory
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$t = pinba_timer_start(array("group" => "loop"));
+
+function retag($t, $n) {
+	for ($i = 0; $i < $n; $i++) {
+		pinba_timer_tags_merge($t, array("step" => $i % 10));
+		pinba_timer_tags_replace($t, array("group" => "loop", "step" => $i % 10));
+	}
+}
+
+retag($t, 1000);
+$before = memory_get_usage();
+retag($t, 10000);
+var_dump(memory_get_usage() - $before < 4096);
+var_dump(pinba_timer_get_info($t)["tags"]);
+?>
+--EXPECT--
+bool(true)
+array(2) {
+  ["group"]=>
+  string(4) "loop"
+  ["step"]=>
+  string(1) "9"
+}
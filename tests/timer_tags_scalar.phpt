@@ -0,0 +1,36 @@
+--TEST--
+Timer tags with scalar values
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$t = pinba_timer_add(array("int" => 42, "neg" => -7, "min" => PHP_INT_MIN, "true" => true, "false" => false, "null" => null, "float" => 1.5, "str" => "x"), 0.1);
+var_dump(pinba_timer_get_info($t)["tags"]);
+
+// an int and its string form are the same tag
+pinba_timer_add(array("code" => 200), 0.1);
+pinba_timer_add(array("code" => "200"), 0.1);
+$packet = pinba_decode(pinba_get_data());
+var_dump(count($packet["timers"]), $packet["timers"][1]["hit_count"]);
+?>
+--EXPECTF--
+array(8) {
+  ["false"]=>
+  string(0) ""
+  ["float"]=>
+  string(3) "1.5"
+  ["int"]=>
+  string(2) "42"
+  ["min"]=>
+  string(%d) "-%d"
+  ["neg"]=>
+  string(2) "-7"
+  ["null"]=>
+  string(0) ""
+  ["str"]=>
+  string(1) "x"
+  ["true"]=>
+  string(1) "1"
+}
+int(2)
+int(2)
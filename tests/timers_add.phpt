@@ -0,0 +1,61 @@
+--TEST--
+pinba_timers_add() and PinbaClient::addTimers()
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$batch = array();
+for ($i = 0; $i < 100; $i++) {
+	$batch[] = array(array("group" => "sql", "op" => $i % 2 ? "select" : "update"), 0.01);
+}
+$batch[] = array(pinba_tagset_create(array("group" => "http")), 0.5, 3, array(0.1, 0.2));
+var_dump(pinba_timers_add($batch));
+
+// no timer objects are created
+var_dump(count(pinba_timers_get()));
+
+var_dump(pinba_timers_add(array(array(array("group" => "sql"), -1), "bad", array(array("group" => "sql", "op" => "select"), 0.01))));
+var_dump(pinba_timers_add(array(
+	array(array("group" => "sql"), 0.01, 0),
+	array(array("group" => "sql"), "slow"),
+	array(array("group" => "sql"), 0.01, "many"),
+	array(array("group" => "sql"), 0.01, 1, array("fast", 0)),
+)));
+
+$packet = pinba_decode(pinba_get_data());
+foreach ($packet["timers"] as $timer) {
+	ksort($timer["tags"]);
+	echo json_encode($timer["tags"]), " ", $timer["hit_count"], " ", round($timer["value"], 2), " ", round($timer["ru_utime"], 1), "\n";
+}
+
+$client = new PinbaClient(array("127.0.0.1"));
+var_dump($client->addTimers(array(
+	array(array("group" => "queue"), 0.25),
+	array(array("group" => "queue"), 0.25, 2),
+)));
+$packet = pinba_decode($client->getData());
+var_dump($packet["timers"][0]["hit_count"], $packet["timers"][0]["value"]);
+?>
+--EXPECTF--
+bool(true)
+int(0)
+
+Warning: pinba_timers_add(): batch entry #0: timer value cannot be less than 0 in %s on line %d
+
+Warning: pinba_timers_add(): batch entry #1 must be an array in %s on line %d
+bool(false)
+
+Warning: pinba_timers_add(): batch entry #0: timer hit count must be greater than 0 (0 was passed) in %s on line %d
+
+Warning: pinba_timers_add(): batch entry #1: timer value must be a number in %s on line %d
+
+Warning: pinba_timers_add(): batch entry #2: timer hit count must be an integer in %s on line %d
+
+Warning: pinba_timers_add(): batch entry #3: rusage values must be numbers in %s on line %d
+bool(false)
+{"group":"sql","op":"update"} 50 0.5 0
+{"group":"sql","op":"select"} 51 0.51 0
+{"group":"http"} 3 0.5 0.1
+bool(true)
+int(3)
+float(0.5)
@@ -0,0 +1,38 @@
+--TEST--
+pinba_timers_get(), pinba_timers_stop() and pinba_timer_delete()
+--SKIPIF--
+<?php if (!extension_loaded("pinba")) print "skip"; ?>
+--FILE--
+<?php
+$fp = fopen(__FILE__, "r"); // unrelated resource
+
+$t1 = pinba_timer_start(array("n" => 1));
+$t2 = pinba_timer_start(array("n" => 2));
+$t3 = pinba_timer_add(array("n" => 3), 0.5);
+$t4 = pinba_timer_start(array("n" => 4));
+
+pinba_timer_stop($t2);
+var_dump(count(pinba_timers_get()));
+var_dump(count(pinba_timers_get(PINBA_ONLY_STOPPED_TIMERS)));
+
+pinba_timer_delete($t4);
+var_dump(count(pinba_timers_get()));
+
+var_dump(pinba_timers_stop());
+foreach (pinba_timers_get() as $t) {
+	$info = pinba_timer_get_info($t);
+	echo $info["tags"]["n"], " ", var_export($info["started"], true), "\n";
+}
+
+$info = pinba_get_info();
+var_dump(count($info["timers"]));
+?>
+--EXPECT--
+int(4)
+int(2)
+int(3)
+bool(true)
+1 false
+2 false
+3 false
+int(3)